@@ -2,6 +2,8 @@
 
 #define NOOPENVR
 #include "common.hpp"
+#include "delta_update.hpp"
+#include "message_pool.hpp"
 
 #define OLC_PGE_APPLICATION
 #include "olcPixelGameEngine.h"
@@ -9,9 +11,168 @@
 #define OLC_PGEX_TRANSFORMEDVIEW
 #include "olcPGEX_TransformedView.h"
 
+#include <algorithm>
 #include <chrono>
 #include <unordered_map>
 
+// Optional udp fast path for Client_UpdateDevice,
+// registration and everything else still goes over the tcp connection
+class UdpUpdateSender {
+public:
+    UdpUpdateSender()
+        : m_socket(m_context)
+    {
+    }
+
+    bool Open(const std::string& host, const uint16_t port)
+    {
+        try {
+            asio::ip::udp::resolver resolver(m_context);
+            m_endpoint = *resolver.resolve(asio::ip::udp::v4(), host, std::to_string(port)).begin();
+            m_socket.open(asio::ip::udp::v4());
+        } catch (std::exception& e) {
+            std::cerr << "[UDP] Exception: " << e.what() << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    bool IsOpen() const
+    {
+        return m_socket.is_open();
+    }
+
+    void Send(const olc::net::message<HeaderStatus>& msg, const uint32_t nUniqueID)
+    {
+        sDatagramHeader dgram;
+        dgram.header = msg.header;
+        dgram.nUniqueID = nUniqueID;
+        dgram.nSequence = m_nSequence++;
+
+        const std::array<asio::const_buffer, 2> buffers = { {
+            asio::buffer(&dgram, sizeof(dgram)),
+            asio::buffer(msg.body),
+        } };
+
+        try {
+            m_socket.send_to(buffers, m_endpoint);
+        } catch (std::exception& e) {
+            std::cerr << "[UDP] Exception: " << e.what() << "\n";
+        }
+    }
+
+private:
+    asio::io_context m_context;
+    asio::ip::udp::socket m_socket;
+    asio::ip::udp::endpoint m_endpoint;
+    uint32_t m_nSequence = 0;
+};
+
+// Optional shared memory ring for same-host clients,
+// the server sets it up after we ask for it with Client_RequestSharedMemory
+class ShmUpdateSender {
+public:
+    bool Open(const std::string& name)
+    {
+        return m_channel.Open(name);
+    }
+
+    bool IsOpen() const
+    {
+        return static_cast<bool>(m_channel);
+    }
+
+    // the server makes a new one for every connection
+    void Close()
+    {
+        m_channel.Close();
+    }
+
+    // returns false if the update got dropped, nUniqueID is the device it's for, batches carry their own
+    bool Send(const olc::net::message<HeaderStatus>& msg, const uint32_t nUniqueID)
+    {
+        sShmRingSlot slot;
+        if (msg.body.size() > slot.aBody.size())
+            return false;
+
+        slot.eHeader = msg.header.id;
+        slot.nUniqueID = nUniqueID;
+        slot.nSize = static_cast<uint32_t>(msg.body.size());
+        std::copy(msg.body.begin(), msg.body.end(), slot.aBody.begin());
+
+        // server fell behind, drop this one, the next update supersedes it anyway
+        if (!m_channel->ring.Push(slot)) {
+            m_nDropped++;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    hvr::shm::SharedObject<sShmDeviceChannel> m_channel;
+    uint64_t m_nDropped = 0;
+};
+
+enum class UpdateTransport : int {
+    Tcp,
+    Udp,
+    Shm,
+};
+
+enum class UpdateFormat : int {
+    Full,
+    Compact,
+    Delta,
+};
+
+// Builds the per frame update message in whichever format we were asked to use
+class UpdateEncoder {
+public:
+    // a full update every this many deltas, so the chain recovers if anything goes wrong
+    static constexpr uint32_t k_nKeyframeInterval = 100;
+
+    UpdateEncoder(const UpdateFormat format)
+        : m_format(format)
+    {
+    }
+
+    void Write(olc::net::message<HeaderStatus>& msg, const sDeviceNetPacket& desc)
+    {
+        switch (m_format) {
+        case UpdateFormat::Compact:
+            WriteCompactUpdate(msg, desc, true);
+            break;
+
+        case UpdateFormat::Delta:
+            if (m_nSinceKeyframe++ < k_nKeyframeInterval) {
+                hvr::delta::WriteDeltaUpdate(msg, m_base, desc);
+                m_base = desc;
+                break;
+            }
+            m_nSinceKeyframe = 0;
+            m_base = desc;
+            [[fallthrough]];
+
+        case UpdateFormat::Full:
+        default:
+            msg.header.id = HeaderStatus::Client_UpdateDevice;
+            msg << desc;
+            break;
+        }
+    }
+
+    // the server might not have seen our last update, start over with a full one
+    void ForceKeyframe()
+    {
+        m_nSinceKeyframe = k_nKeyframeInterval;
+    }
+
+private:
+    UpdateFormat m_format;
+    sDeviceNetPacket m_base;
+    uint32_t m_nSinceKeyframe = k_nKeyframeInterval;
+};
+
 class Benchmark : public olc::net::client_interface<HeaderStatus> {
     std::unordered_map<uint32_t, sDeviceNetPacket> mapObjects;
     uint32_t nPlayerID = 0;
@@ -19,14 +180,48 @@ class Benchmark : public olc::net::client_interface<HeaderStatus> {
 
     bool bWaitingForConnection = true;
 
+    UpdateTransport m_transport;
+    UdpUpdateSender m_udp;
+    ShmUpdateSender m_shm;
+
+    UpdateEncoder m_encoder;
+    uint32_t m_nSubscriptions;
+
+    // the per frame update message, so building it doesn't allocate. olc still copies it on Send
+    hvr::net::MessagePool<HeaderStatus> m_message_pool { 2, sizeof(sDeviceNetPacket) + sizeof(uint32_t) };
+
+    // our updates are stamped in server time
+    hvr::clock::ClockSync m_clock;
+
+    // 0 lets the server pick one
+    uint64_t m_nResumeToken;
+    // after the first Client_AssignID a lost connection gets retried with m_nResumeToken
+    bool m_bRegistered = false;
+    uint64_t m_nNextReconnect = 0;
+
+    // extra devices registered over this connection, sent together in one batch per frame
+    uint32_t m_nExtraDevices;
+    std::vector<sDeviceNetPacket> m_vBatch;
+
 public:
-    Benchmark() = default;
+    Benchmark(const UpdateTransport transport, const UpdateFormat format, const uint32_t subscriptions, const uint32_t extra_devices, const uint64_t resume_token)
+        : m_transport(transport)
+        , m_encoder(format)
+        , m_nSubscriptions(subscriptions)
+        , m_nResumeToken(resume_token)
+        , m_nExtraDevices(extra_devices)
+    {
+    }
 
     void Init()
     {
 
         if (Connect("127.0.0.1", 60000)) {
         }
+
+        if (m_transport == UpdateTransport::Udp && !m_udp.Open("127.0.0.1", 60000)) {
+            m_transport = UpdateTransport::Tcp;
+        }
     }
 
     void Update()
@@ -44,6 +239,8 @@ public:
                     msg.header.id = HeaderStatus::Client_RegisterWithServer;
                     descPlayer.vPos = { 3.0f, 0, 3.0f };
                     msg << descPlayer;
+                    msg << sRegisterOptions { m_nSubscriptions };
+                    msg << sResumeToken { m_nResumeToken };
                     Send(msg);
                     break;
                 }
@@ -52,6 +249,45 @@ public:
                     // Server is assigning us OUR id
                     msg >> nPlayerID;
                     std::cout << "Assigned Client ID = " << nPlayerID << "\n";
+
+                    // presented again if we ever register again, the server gives us our devices back
+                    if (msg.body.size() >= sizeof(m_nResumeToken))
+                        msg >> m_nResumeToken;
+                    std::cout << "Session serial = " << m_nResumeToken << ", enter it next time to pick these devices up again\n";
+                    m_bRegistered = true;
+
+                    if (m_transport == UpdateTransport::Shm) {
+                        olc::net::message<HeaderStatus> msgShm;
+                        msgShm.header.id = HeaderStatus::Client_RequestSharedMemory;
+                        Send(msgShm);
+                    }
+
+                    for (uint32_t sub = 1; sub <= m_nExtraDevices; sub++) {
+                        olc::net::message<HeaderStatus> msgSub;
+                        msgSub.header.id = HeaderStatus::Client_RegisterSubDevice;
+                        sDeviceNetPacket descSub = descPlayer;
+                        descSub.nUniqueID = sub;
+                        msgSub << descSub;
+                        Send(msgSub);
+                    }
+                    break;
+                }
+
+                case (HeaderStatus::Client_AssignSubID): {
+                    sSubDeviceID sub;
+                    msg >> sub;
+                    std::cout << "Assigned sub device " << sub.nSubIndex << " ID = " << sub.nUniqueID << "\n";
+
+                    sDeviceNetPacket descSub = descPlayer;
+                    descSub.nUniqueID = sub.nUniqueID;
+                    m_vBatch.push_back(descSub);
+                    break;
+                }
+
+                case (HeaderStatus::Client_SharedMemoryReady): {
+                    if (!m_shm.Open(ShmChannelName(60000, nPlayerID))) {
+                        std::cout << "Failed to open shared memory channel, staying on tcp\n";
+                    }
                     break;
                 }
 
@@ -80,27 +316,203 @@ public:
                     mapObjects.insert_or_assign(desc.nUniqueID, desc);
                     break;
                 }
+
+                case (HeaderStatus::Client_UpdateDeviceBatch): {
+                    uint32_t count = 0;
+                    msg >> count;
+                    for (uint32_t i = 0; i < count && msg.body.size() >= sizeof(sDeviceNetPacket); i++) {
+                        sDeviceNetPacket desc;
+                        msg >> desc;
+                        mapObjects.insert_or_assign(desc.nUniqueID, desc);
+                    }
+                    break;
+                }
+
+                case (HeaderStatus::Client_Snapshot): {
+                    // same layout as a batch, but it has our own devices in it too, we know better about those
+                    uint32_t count = 0;
+                    msg >> count;
+                    for (uint32_t i = 0; i < count && msg.body.size() >= sizeof(sDeviceNetPacket); i++) {
+                        sDeviceNetPacket desc;
+                        msg >> desc;
+                        if (ConnectionOf(desc.nUniqueID) != nPlayerID)
+                            mapObjects.insert_or_assign(desc.nUniqueID, desc);
+                    }
+                    break;
+                }
+
+                case (HeaderStatus::Client_UpdateDeviceCompact): {
+                    // the server tags bounced compact updates with the sender id
+                    uint32_t nUniqueID = 0;
+                    msg >> nUniqueID;
+                    ReadCompactUpdate(hvr::net::ByteView(msg.body), mapObjects[nUniqueID]);
+                    break;
+                }
+
+                case (HeaderStatus::Server_GetPing): {
+                    hvr::clock::sPingPayload pong;
+                    if (msg.body.size() == sizeof(pong)) {
+                        msg >> pong;
+                        m_clock.OnPong(pong, hvr::clock::NowMicros());
+                    }
+                    break;
+                }
                 }
             }
+        } else {
+            ReconnectIfDue();
         }
 
-        // Send player description
-        olc::net::message<HeaderStatus> msg;
-        msg.header.id = HeaderStatus::Client_UpdateDevice;
-        msg << mapObjects[nPlayerID];
-        Send(msg);
+        const uint64_t now = hvr::clock::NowMicros();
+        SendPingIfDue(now);
+
+        // Send player description, with extra devices registered everything goes out as a single batch
+        mapObjects[nPlayerID].nCaptureTimeUs = m_clock.ToServerTime(now);
+        auto msg = m_message_pool.Acquire();
+        if (!m_vBatch.empty()) {
+            for (auto& desc : m_vBatch) {
+                desc.nCaptureTimeUs = mapObjects[nPlayerID].nCaptureTimeUs;
+            }
+            m_vBatch.push_back(mapObjects[nPlayerID]);
+            WriteBatchUpdate(msg, m_vBatch.data(), static_cast<uint32_t>(m_vBatch.size()));
+            m_vBatch.pop_back();
+            // too many devices for a ring slot goes over tcp, so does one the ring had no room for
+            if (!m_shm.IsOpen() || !m_shm.Send(msg, nPlayerID))
+                Send(msg);
+        } else {
+            m_encoder.Write(msg, mapObjects[nPlayerID]);
+            if (m_shm.IsOpen()) {
+                if (!m_shm.Send(msg, nPlayerID))
+                    m_encoder.ForceKeyframe();
+            } else if (m_transport == UpdateTransport::Udp && !bWaitingForConnection)
+                m_udp.Send(msg, nPlayerID);
+            else
+                Send(msg);
+        }
+        m_message_pool.Release(std::move(msg));
 
         // check final frame time
         const auto end = std::chrono::high_resolution_clock::now();
         std::cout << "elapsed(ns): " << std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() << "\n";
     }
+
+    // The server holds on to our devices for a while after the connection drops, registering again
+    // with the serial it gave us gets them back. Tried once a second until it takes
+    void ReconnectIfDue()
+    {
+        const uint64_t now = hvr::clock::NowMicros();
+        if (!m_bRegistered || now < m_nNextReconnect)
+            return;
+        m_nNextReconnect = now + 1000000;
+
+        std::cout << "Lost the server, reconnecting with session serial " << m_nResumeToken << "\n";
+        Disconnect();
+        // Disconnect stops the context and Connect doesn't restart it
+        m_context.restart();
+        m_shm.Close();
+        m_encoder.ForceKeyframe();
+        mapObjects.clear();
+        // they get registered again on Client_AssignID
+        m_vBatch.clear();
+        bWaitingForConnection = true;
+        Connect("127.0.0.1", 60000);
+    }
+
+    // pings always go over tcp, the server answers on the same connection
+    void SendPingIfDue(const uint64_t now)
+    {
+        if (bWaitingForConnection || !m_clock.PingDue(now))
+            return;
+
+        olc::net::message<HeaderStatus> msg;
+        msg.header.id = HeaderStatus::Server_GetPing;
+        msg << m_clock.MakePing(now);
+        Send(msg);
+    }
+};
+
+// Polls Server_GetStatus and Server_GetPing once a second and prints what comes back,
+// never registers a device so it doesn't show up anywhere
+class Monitor : public olc::net::client_interface<HeaderStatus> {
+    hvr::clock::ClockSync m_clock;
+    uint64_t m_nLastPoll = 0;
+    bool bAccepted = false;
+
+public:
+    bool Init()
+    {
+        return Connect("127.0.0.1", 60000);
+    }
+
+    void Update()
+    {
+        if (!IsConnected())
+            return;
+
+        while (!Incoming().empty()) {
+            auto msg = Incoming().pop_front().msg;
+
+            switch (msg.header.id) {
+            case (HeaderStatus::Client_Accepted): {
+                bAccepted = true;
+                break;
+            }
+
+            case (HeaderStatus::Server_GetPing): {
+                hvr::clock::sPingPayload pong;
+                if (msg.body.size() == sizeof(pong)) {
+                    msg >> pong;
+                    m_clock.OnPong(pong, hvr::clock::NowMicros());
+                    std::cout << "rtt(us): " << m_clock.RoundTripMicros() << " clock offset(us): " << m_clock.OffsetMicros() << "\n";
+                }
+                break;
+            }
+
+            case (HeaderStatus::Server_GetStatus): {
+                sServerStatus status;
+                if (msg.body.size() != sizeof(status))
+                    break;
+
+                msg >> status;
+                std::cout << "clients: " << status.nConnectedClients << " (" << status.nRegisteredClients << " registered)"
+                          << " devices: " << status.nActiveDevices << " (" << status.nDeactivatedDevices << " deactivated)"
+                          << " msgs/s: " << status.nMessagesPerSecond
+                          << " queued in/out: " << status.nIncomingQueueDepth << "/" << status.nOutgoingQueueDepth
+                          << " coalesced: " << status.nCoalescedUpdates
+                          << " dropped: " << status.nDroppedOutgoing << "\n";
+                break;
+            }
+
+            default:
+                break;
+            }
+        }
+
+        const uint64_t now = hvr::clock::NowMicros();
+        if (!bAccepted || now - m_nLastPoll < 1000000)
+            return;
+        m_nLastPoll = now;
+
+        olc::net::message<HeaderStatus> msgPing;
+        msgPing.header.id = HeaderStatus::Server_GetPing;
+        msgPing << m_clock.MakePing(now);
+        Send(msgPing);
+
+        olc::net::message<HeaderStatus> msgStatus;
+        msgStatus.header.id = HeaderStatus::Server_GetStatus;
+        Send(msgStatus);
+    }
 };
 
 class MMOGame : public olc::PixelGameEngine, olc::net::client_interface<HeaderStatus> {
 public:
-    MMOGame(const DeviceType type, const DeviceRole role)
+    MMOGame(const DeviceType type, const DeviceRole role, const UpdateTransport transport, const UpdateFormat format, const uint32_t subscriptions, const uint64_t resume_token)
         : m_device_type(type)
         , m_device_role(role)
+        , m_transport(transport)
+        , m_encoder(format)
+        , m_nSubscriptions(subscriptions)
+        , m_nResumeToken(resume_token)
     {
         std::cout << "starting with device type: " << static_cast<int>(type) << "\n";
         sAppName = "MMO Client";
@@ -111,6 +523,25 @@ private:
     DeviceRole m_device_role;
     olc::TileTransformedView tv;
 
+    UpdateTransport m_transport;
+    UdpUpdateSender m_udp;
+    ShmUpdateSender m_shm;
+
+    UpdateEncoder m_encoder;
+    uint32_t m_nSubscriptions;
+
+    // the per frame update message, so building it doesn't allocate. olc still copies it on Send
+    hvr::net::MessagePool<HeaderStatus> m_message_pool { 2, sizeof(sDeviceNetPacket) + sizeof(uint32_t) };
+
+    // our updates are stamped in server time
+    hvr::clock::ClockSync m_clock;
+
+    // 0 lets the server pick one
+    uint64_t m_nResumeToken;
+    // after the first Client_AssignID a lost connection gets retried with m_nResumeToken
+    bool m_bRegistered = false;
+    uint64_t m_nNextReconnect = 0;
+
     std::string sWorldMap = "################################"
                             "#..............................#"
                             "#..............................#"
@@ -162,11 +593,15 @@ public:
         // mapObjects[0].vPos = { 3.0f, 3.0f };
         std::cout << "network packet size: " << sizeof(sDeviceNetPacket) << "\n";
 
-        if (Connect("127.0.0.1", 60000)) {
-            return true;
+        if (!Connect("127.0.0.1", 60000)) {
+            return false;
+        }
+
+        if (m_transport == UpdateTransport::Udp && !m_udp.Open("127.0.0.1", 60000)) {
+            m_transport = UpdateTransport::Tcp;
         }
 
-        return false;
+        return true;
     }
 
     bool OnUserUpdate(float fElapsedTime) override
@@ -185,6 +620,8 @@ public:
                     descPlayer.eDeviceType = m_device_type;
                     descPlayer.eDeviceRole = m_device_role;
                     msg << descPlayer;
+                    msg << sRegisterOptions { m_nSubscriptions };
+                    msg << sResumeToken { m_nResumeToken };
                     Send(msg);
                     break;
                 }
@@ -193,6 +630,25 @@ public:
                     // Server is assigning us OUR id
                     msg >> nPlayerID;
                     std::cout << "Assigned Client ID = " << nPlayerID << "\n";
+
+                    // presented again if we ever register again, the server gives us our devices back
+                    if (msg.body.size() >= sizeof(m_nResumeToken))
+                        msg >> m_nResumeToken;
+                    std::cout << "Session serial = " << m_nResumeToken << ", enter it next time to pick these devices up again\n";
+                    m_bRegistered = true;
+
+                    if (m_transport == UpdateTransport::Shm) {
+                        olc::net::message<HeaderStatus> msgShm;
+                        msgShm.header.id = HeaderStatus::Client_RequestSharedMemory;
+                        Send(msgShm);
+                    }
+                    break;
+                }
+
+                case (HeaderStatus::Client_SharedMemoryReady): {
+                    if (!m_shm.Open(ShmChannelName(60000, nPlayerID))) {
+                        std::cout << "Failed to open shared memory channel, staying on tcp\n";
+                    }
                     break;
                 }
 
@@ -221,8 +677,69 @@ public:
                     mapObjects.insert_or_assign(desc.nUniqueID, desc);
                     break;
                 }
+
+                case (HeaderStatus::Client_UpdateDeviceBatch): {
+                    uint32_t count = 0;
+                    msg >> count;
+                    for (uint32_t i = 0; i < count && msg.body.size() >= sizeof(sDeviceNetPacket); i++) {
+                        sDeviceNetPacket desc;
+                        msg >> desc;
+                        mapObjects.insert_or_assign(desc.nUniqueID, desc);
+                    }
+                    break;
+                }
+
+                case (HeaderStatus::Client_Snapshot): {
+                    // same layout as a batch, but it has our own devices in it too, we know better about those
+                    uint32_t count = 0;
+                    msg >> count;
+                    for (uint32_t i = 0; i < count && msg.body.size() >= sizeof(sDeviceNetPacket); i++) {
+                        sDeviceNetPacket desc;
+                        msg >> desc;
+                        if (ConnectionOf(desc.nUniqueID) != nPlayerID)
+                            mapObjects.insert_or_assign(desc.nUniqueID, desc);
+                    }
+                    break;
+                }
+
+                case (HeaderStatus::Client_UpdateDeviceCompact): {
+                    // the server tags bounced compact updates with the sender id
+                    uint32_t nUniqueID = 0;
+                    msg >> nUniqueID;
+                    ReadCompactUpdate(hvr::net::ByteView(msg.body), mapObjects[nUniqueID]);
+                    break;
+                }
+
+                case (HeaderStatus::Server_GetPing): {
+                    hvr::clock::sPingPayload pong;
+                    if (msg.body.size() == sizeof(pong)) {
+                        msg >> pong;
+                        m_clock.OnPong(pong, hvr::clock::NowMicros());
+                    }
+                    break;
+                }
+
+                case (HeaderStatus::Client_Haptic): {
+                    // this is where a real device would buzz
+                    sHapticPulse pulse;
+                    if (msg.body.size() != sizeof(pulse))
+                        break;
+                    msg >> pulse;
+
+                    std::cout << "haptic for " << pulse.nUniqueID << ": " << pulse.fDurationSeconds << " s, "
+                              << pulse.fFrequency << " Hz, amplitude " << pulse.fAmplitude;
+                    if (m_clock.Synced()) {
+                        // from vrserver raising the event to here
+                        const auto latency = static_cast<int64_t>(m_clock.ToServerTime(hvr::clock::NowMicros()) - pulse.nEventTimeUs);
+                        std::cout << ", " << latency / 1000.0 << " ms after the event";
+                    }
+                    std::cout << "\n";
+                    break;
+                }
                 }
             }
+        } else {
+            ReconnectIfDue();
         }
 
         if (bWaitingForConnection) {
@@ -245,6 +762,14 @@ public:
         if (mapObjects[nPlayerID].vVel.mag2() > 0)
             mapObjects[nPlayerID].vVel = mapObjects[nPlayerID].vVel.norm() * 4.0f;
 
+        // space pulls the trigger, and makes a fist on an Index-like controller
+        const bool grab = GetKey(olc::Key::SPACE).bHeld;
+        mapObjects[nPlayerID].bBoolStates[InputBit_TriggerClick] = grab;
+        mapObjects[nPlayerID].aFloatStates[InputFloat_Trigger] = grab ? 1.0f : 0.0f;
+        for (int finger = 0; finger < 5; finger++) {
+            mapObjects[nPlayerID].aFloatStates[InputFloat_ThumbCurl + finger] = grab ? 1.0f : 0.0f;
+        }
+
         // Update objects locally
         for (auto& object : mapObjects) {
             // Where will object be worst case?
@@ -339,31 +864,109 @@ public:
             tv.DrawStringPropDecal(tmp_pos - olc::vf2d { vNameSize.x * 0.5f * 0.25f * 0.125f, -0.5f * 1.25f }, "ID: " + std::to_string(object.first), olc::BLUE, { 0.25f, 0.25f });
         }
 
+        const uint64_t now = hvr::clock::NowMicros();
+        SendPingIfDue(now);
+
         // Send player description
-        olc::net::message<HeaderStatus> msg;
-        msg.header.id = HeaderStatus::Client_UpdateDevice;
-        msg << mapObjects[nPlayerID];
-        Send(msg);
+        mapObjects[nPlayerID].nCaptureTimeUs = m_clock.ToServerTime(now);
+        auto msg = m_message_pool.Acquire();
+        m_encoder.Write(msg, mapObjects[nPlayerID]);
+        if (m_shm.IsOpen()) {
+            if (!m_shm.Send(msg, nPlayerID))
+                m_encoder.ForceKeyframe();
+        } else if (m_transport == UpdateTransport::Udp && !bWaitingForConnection)
+            m_udp.Send(msg, nPlayerID);
+        else
+            Send(msg);
+        m_message_pool.Release(std::move(msg));
 
         std::this_thread::sleep_for(std::chrono::milliseconds(5));
         return true;
     }
+
+    // The server holds on to our devices for a while after the connection drops, registering again
+    // with the serial it gave us gets them back. Tried once a second until it takes
+    void ReconnectIfDue()
+    {
+        const uint64_t now = hvr::clock::NowMicros();
+        if (!m_bRegistered || now < m_nNextReconnect)
+            return;
+        m_nNextReconnect = now + 1000000;
+
+        std::cout << "Lost the server, reconnecting with session serial " << m_nResumeToken << "\n";
+        Disconnect();
+        // Disconnect stops the context and Connect doesn't restart it
+        m_context.restart();
+        m_shm.Close();
+        m_encoder.ForceKeyframe();
+        mapObjects.clear();
+        bWaitingForConnection = true;
+        Connect("127.0.0.1", 60000);
+    }
+
+    // pings always go over tcp, the server answers on the same connection
+    void SendPingIfDue(const uint64_t now)
+    {
+        if (bWaitingForConnection || !m_clock.PingDue(now))
+            return;
+
+        olc::net::message<HeaderStatus> msg;
+        msg.header.id = HeaderStatus::Server_GetPing;
+        msg << m_clock.MakePing(now);
+        Send(msg);
+    }
 };
 
 int main()
 {
     int choice;
-    std::cout << "bench/demo? [0/1]\n";
+    std::cout << "bench/demo/monitor? [0/1/2]\n";
     std::cin >> choice;
+
+    if (choice == 2) {
+        Monitor monitor;
+        if (!monitor.Init())
+            return 1;
+        while (1) {
+            monitor.Update();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    int transport_choice;
+    std::cout << "update transport? tcp/udp/shared memory [0/1/2]\n";
+    std::cin >> transport_choice;
+    const auto transport = static_cast<UpdateTransport>(std::clamp(transport_choice, 0, 2));
+
+    int format_choice;
+    std::cout << "update format? full/compact/delta [0/1/2]\n";
+    std::cin >> format_choice;
+    auto format = static_cast<UpdateFormat>(std::clamp(format_choice, 0, 2));
+
+    if (format == UpdateFormat::Delta && transport == UpdateTransport::Udp) {
+        std::cout << "delta updates need ordered delivery, sending full updates over udp instead\n";
+        format = UpdateFormat::Full;
+    }
+
+    int subscribe;
+    std::cout << "receive the other devices? [0/1]\n";
+    std::cin >> subscribe;
+    const uint32_t subscriptions = subscribe ? Subscribe_All : Subscribe_None;
+
+    // the same serial on every start picks up the devices of the last run, if it was cut off recently
+    uint64_t resume_token;
+    std::cout << "session serial? [0 for a new session]\n";
+    std::cin >> resume_token;
     if (choice) {
         char devicetype;
 
-        std::cout << "device type? [t/c]";
+        std::cout << "device type? [t/c/i]";
         std::cin.clear();
         std::cin >> devicetype;
 
         std::unordered_map<char, DeviceType> types = {
             { 'c', DeviceType::ControllerViveLike },
+            { 'i', DeviceType::ControllerIndexLike },
             { 't', DeviceType::Tracker },
         };
 
@@ -379,11 +982,15 @@ int main()
             device_role = DeviceRole::Neither;
         }
 
-        MMOGame demo(device_type, device_role);
+        MMOGame demo(device_type, device_role, transport, format, subscriptions, resume_token);
         if (demo.Construct(480, 480, 1, 1))
             demo.Start();
     } else {
-        Benchmark test;
+        int extra_devices;
+        std::cout << "extra devices on this connection? [0-255]\n";
+        std::cin >> extra_devices;
+
+        Benchmark test(transport, format, subscriptions, static_cast<uint32_t>(std::clamp(extra_devices, 0, 255)), resume_token);
         test.Init();
         while (1) {
             test.Update();
@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#ifndef CLOCK_SYNC_HPP
+#define CLOCK_SYNC_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Clock sync for capture timestamps.
+// Every timestamp on the wire is in server time, microseconds of the server's steady clock.
+// Clients estimate the offset of their own clock with a Server_GetPing round trip every now and then
+// and stamp their updates in server time, the driver turns that into poseTimeOffset.
+namespace hvr::clock {
+
+inline uint64_t NowMicros()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch())
+                                     .count());
+}
+
+// Server_GetPing body, the client fills in its send time, the server adds its receive and send time
+// and echoes it straight back.
+// The receive time is when the driver's OnMessage got to it, not when it came off the socket. olc doesn't
+// timestamp its incoming queue, so whatever the ping spent waiting in there counts as network time on the way
+// in and pushes the offset up by half of it
+struct sPingPayload {
+    uint64_t nClientSendUs = 0;
+    uint64_t nServerRecvUs = 0;
+    uint64_t nServerSendUs = 0;
+};
+
+// Offset estimate out of the last few round trips. The one with the shortest round trip
+// spent the least time sitting in queues, so its offset is the one we trust.
+// Picked by the whole round trip, server time included, that's the only place the wait
+// in the driver's incoming queue shows up.
+class ClockSync {
+public:
+    static constexpr size_t k_nSamples = 8;
+    // pings go out quickly until we have a few samples, then settle down to this
+    static constexpr uint64_t k_nPingIntervalUs = 1000000;
+    static constexpr uint64_t k_nFastPingIntervalUs = 100000;
+
+    bool PingDue(const uint64_t now) const
+    {
+        const uint64_t interval = m_nCount < k_nSamples ? k_nFastPingIntervalUs : k_nPingIntervalUs;
+        return now - m_nLastPing >= interval;
+    }
+
+    sPingPayload MakePing(const uint64_t now)
+    {
+        m_nLastPing = now;
+
+        sPingPayload ping;
+        ping.nClientSendUs = now;
+        return ping;
+    }
+
+    void OnPong(const sPingPayload& pong, const uint64_t now)
+    {
+        // time spent on the server doesn't count towards the round trip
+        const int64_t server_time = static_cast<int64_t>(pong.nServerSendUs - pong.nServerRecvUs);
+        const int64_t round_trip = static_cast<int64_t>(now - pong.nClientSendUs) - server_time;
+        if (round_trip < 0 || pong.nClientSendUs == 0)
+            return;
+
+        // assumes both ways took the same time
+        const int64_t offset = (static_cast<int64_t>(pong.nServerRecvUs - pong.nClientSendUs)
+                                   + static_cast<int64_t>(pong.nServerSendUs - now))
+            / 2;
+
+        m_aSamples[m_nCount % k_nSamples] = { round_trip, round_trip + server_time, offset };
+        m_nCount++;
+
+        const size_t used = m_nCount < k_nSamples ? m_nCount : k_nSamples;
+        const sSample* best = &m_aSamples[0];
+        for (size_t i = 1; i < used; i++) {
+            if (m_aSamples[i].nTotalUs < best->nTotalUs)
+                best = &m_aSamples[i];
+        }
+        m_nOffsetUs = best->nOffsetUs;
+        m_nRoundTripUs = best->nRoundTripUs;
+    }
+
+    bool Synced() const
+    {
+        return m_nCount != 0;
+    }
+
+    // 0 until the first pong came back, the driver treats that as "no timestamp"
+    uint64_t ToServerTime(const uint64_t local) const
+    {
+        if (!Synced())
+            return 0;
+        return local + m_nOffsetUs;
+    }
+
+    int64_t OffsetMicros() const
+    {
+        return m_nOffsetUs;
+    }
+
+    int64_t RoundTripMicros() const
+    {
+        return m_nRoundTripUs;
+    }
+
+private:
+    struct sSample {
+        int64_t nRoundTripUs = 0;
+        // send to pong, with the time the ping sat on the server
+        int64_t nTotalUs = 0;
+        int64_t nOffsetUs = 0;
+    };
+
+    std::array<sSample, k_nSamples> m_aSamples = {};
+    size_t m_nCount = 0;
+    uint64_t m_nLastPing = 0;
+
+    int64_t m_nOffsetUs = 0;
+    int64_t m_nRoundTripUs = 0;
+};
+}
+
+#endif // #ifndef CLOCK_SYNC_HPP
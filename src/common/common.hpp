@@ -16,7 +16,11 @@
 #include <array>
 #include <bitset>
 
+#include "clock_sync.hpp"
+#include "compact_pose.hpp"
 #include "hvr_math.hpp"
+#include "packet_view.hpp"
+#include "shm_ring.hpp"
 
 enum class HeaderStatus : uint32_t {
     Server_GetStatus,
@@ -29,8 +33,94 @@ enum class HeaderStatus : uint32_t {
     Client_AddDevice,
     Client_RemoveDevice,
     Client_UpdateDevice,
+
+    Client_RequestSharedMemory,
+    Client_SharedMemoryReady,
+
+    Client_UpdateDeviceCompact,
+    Client_UpdateDeviceDelta,
+
+    Client_RegisterSubDevice,
+    Client_AssignSubID,
+    Client_UpdateDeviceBatch,
+
+    Client_Snapshot,
+
+    Client_Haptic,
+};
+
+// What a client wants to hear about the other clients' devices
+enum SubscribeFlags : uint32_t {
+    Subscribe_None = 0,
+
+    Subscribe_DeviceAdd = 1U << 0, // Client_AddDevice
+    Subscribe_DeviceRemove = 1U << 1, // Client_RemoveDevice
+    Subscribe_DeviceUpdate = 1U << 2, // bounced Client_UpdateDevice, compact and batch updates
+    Subscribe_Snapshot = 1U << 3, // Client_Snapshot
+
+    Subscribe_All = 0xFFFFFFFFU,
+};
+
+// Optionally sent after the sDeviceNetPacket in Client_RegisterWithServer,
+// clients that leave it out get everything like before.
+// One-way producers should subscribe to nothing, so they don't have to drain
+// a stream of messages they never look at.
+struct sRegisterOptions {
+    uint32_t nSubscriptions = Subscribe_All;
+};
+
+// Optionally sent after sRegisterOptions in Client_RegisterWithServer. A client that got cut off presents
+// the token it got back in Client_AssignID, or any stable value of its own like a hash of its serial,
+// and gets the devices of its old connection back if it returns within the resume timeout.
+// Client_AssignID carries the token in front of the id, 0 means resume is off.
+struct sResumeToken {
+    uint64_t nToken = 0;
 };
 
+// Server_GetStatus reply, the request has an empty body. Any connection can ask, registered or not,
+// so a monitoring tool only has to connect.
+struct sServerStatus {
+    uint64_t nServerTimeUs = 0;
+
+    // validated connections, and the ones of those that registered a device
+    uint32_t nConnectedClients = 0;
+    uint32_t nRegisteredClients = 0;
+
+    uint32_t nActiveDevices = 0;
+    uint32_t nDeactivatedDevices = 0;
+
+    // everything coming in over tcp, udp and shared memory, averaged over the last second
+    uint32_t nMessagesPerSecond = 0;
+
+    // messages waiting for the ipc thread, and waiting to be written out to clients
+    uint32_t nIncomingQueueDepth = 0;
+    uint32_t nOutgoingQueueDepth = 0;
+
+    // updates skipped or dropped since the driver started
+    uint32_t nCoalescedUpdates = 0;
+    uint32_t nDroppedOutgoing = 0;
+};
+
+// Client_Haptic, sent to the connection a controller belongs to. Everything vrserver asked for within
+// one of its frames arrives as a single pulse, as long and as strong as the strongest of them
+struct sHapticPulse {
+    uint32_t nUniqueID = 0;
+    float fDurationSeconds = 0;
+    float fFrequency = 0;
+    float fAmplitude = 0;
+    // when vrserver raised the first of the events, in server time, the client's clock sync
+    // turns it into the latency up to when the pulse reached it
+    uint64_t nEventTimeUs = 0;
+};
+
+// pose updates, the only messages allowed on the udp and shared memory fast paths.
+// Client_UpdateDeviceDelta isn't in here, it needs ordered delivery.
+inline bool IsDeviceUpdate(const HeaderStatus id)
+{
+    return id == HeaderStatus::Client_UpdateDevice
+        || id == HeaderStatus::Client_UpdateDeviceCompact;
+}
+
 enum class DeviceType : uint8_t {
     Hmd,
     HmdDirectDisplay,
@@ -121,9 +211,223 @@ struct sDeviceNetPacket {
     // the skeletal input in the openvr repo inly uses 39 floats per hand
     std::array<float, 64> aFloatStates = { {} };
 
+    // when the pose and inputs were sampled, in server time (see clock_sync.hpp), 0 if the client isn't synced
+    uint64_t nCaptureTimeUs = 0;
+
     // reserved extra to pad the packet to 512 bytes, this takes into account the extra 8 bytes
     // in the header
-    std::array<uint8_t, 136> reserved;
+    std::array<uint8_t, 128> reserved;
+};
+
+// Where the inputs of the stock devices sit in bBoolStates and aFloatStates, anything else is free to use
+enum InputBit : uint8_t {
+    InputBit_AClick,
+    InputBit_ATouch,
+    InputBit_TriggerClick,
 };
 
+enum InputFloat : uint8_t {
+    InputFloat_Trigger,
+
+    // Index-like controllers drive the hand skeleton with these, 0 is open and 1 curled into a fist
+    InputFloat_ThumbCurl,
+    InputFloat_IndexCurl,
+    InputFloat_MiddleCurl,
+    InputFloat_RingCurl,
+    InputFloat_PinkyCurl,
+
+    // -1 to 1, sideways away from the rest pose, positive towards the thumb
+    InputFloat_ThumbSplay,
+    InputFloat_IndexSplay,
+    InputFloat_MiddleSplay,
+    InputFloat_RingSplay,
+    InputFloat_PinkySplay,
+};
+
+// Reads single fields of a sDeviceNetPacket sitting in a receive buffer,
+// without copying the whole thing out first. Valid() has to be checked before anything else.
+class DevicePacketView {
+public:
+    explicit DevicePacketView(const hvr::net::ByteView bytes)
+        : m_bytes(bytes.Slice(0, sizeof(sDeviceNetPacket)))
+    {
+    }
+
+    inline bool Valid() const
+    {
+        return !m_bytes.empty();
+    }
+
+    inline uint32_t UniqueID() const
+    {
+        return Get<uint32_t>(offsetof(sDeviceNetPacket, nUniqueID));
+    }
+
+    inline hvr::math::vec3d Pos() const
+    {
+        return Get<hvr::math::vec3d>(offsetof(sDeviceNetPacket, vPos));
+    }
+
+    inline hvr::math::vec3d Vel() const
+    {
+        return Get<hvr::math::vec3d>(offsetof(sDeviceNetPacket, vVel));
+    }
+
+    inline hvr::math::quatd Rot() const
+    {
+        return Get<hvr::math::quatd>(offsetof(sDeviceNetPacket, vRot));
+    }
+
+    inline hvr::math::vec3d AngVel() const
+    {
+        return Get<hvr::math::vec3d>(offsetof(sDeviceNetPacket, vAngVel));
+    }
+
+    inline std::bitset<16> BoolStates() const
+    {
+        return Get<std::bitset<16>>(offsetof(sDeviceNetPacket, bBoolStates));
+    }
+
+    inline float FloatState(const size_t index) const
+    {
+        return Get<float>(offsetof(sDeviceNetPacket, aFloatStates) + index * sizeof(float));
+    }
+
+    inline uint64_t CaptureTime() const
+    {
+        return Get<uint64_t>(offsetof(sDeviceNetPacket, nCaptureTimeUs));
+    }
+
+private:
+    template <class T>
+    inline T Get(const size_t offset) const
+    {
+        T out {};
+        m_bytes.Read(offset, out);
+        return out;
+    }
+
+    hvr::net::ByteView m_bytes;
+};
+
+// A connection can register extra devices with Client_RegisterSubDevice, putting the sub index
+// it wants (1-255) into nUniqueID. Their ids are derived from the connection id, the device registered
+// with Client_RegisterWithServer is sub index 0 and keeps the plain connection id.
+static constexpr uint32_t k_nSubDeviceShift = 24;
+static constexpr uint32_t k_nMaxSubDevices = 1U << (32 - k_nSubDeviceShift);
+static constexpr uint32_t k_nConnectionIDMask = (1U << k_nSubDeviceShift) - 1;
+
+inline uint32_t MakeDeviceID(const uint32_t nConnectionID, const uint32_t nSubIndex)
+{
+    return (nSubIndex << k_nSubDeviceShift) | (nConnectionID & k_nConnectionIDMask);
+}
+
+inline uint32_t ConnectionOf(const uint32_t nUniqueID)
+{
+    return nUniqueID & k_nConnectionIDMask;
+}
+
+inline uint32_t SubIndexOf(const uint32_t nUniqueID)
+{
+    return nUniqueID >> k_nSubDeviceShift;
+}
+
+// Client_AssignSubID reply
+struct sSubDeviceID {
+    uint32_t nSubIndex = 0;
+    uint32_t nUniqueID = 0;
+};
+
+// Client_UpdateDeviceBatch is a run of full packets with their device ids filled in, followed by the count,
+// so a rig with several devices sends a single message per frame.
+// Client_Snapshot from the server uses the same layout for the state of every device.
+inline void WriteBatchUpdate(olc::net::message<HeaderStatus>& msg, const sDeviceNetPacket* descs, const uint32_t count)
+{
+    msg.header.id = HeaderStatus::Client_UpdateDeviceBatch;
+    const auto* bytes = reinterpret_cast<const uint8_t*>(descs);
+    msg.body.insert(msg.body.end(), bytes, bytes + count * sizeof(sDeviceNetPacket));
+    msg << count;
+}
+
+// Builds a Client_UpdateDeviceCompact message out of desc
+inline void WriteCompactUpdate(olc::net::message<HeaderStatus>& msg, const sDeviceNetPacket& desc, const bool with_velocity)
+{
+    msg.header.id = HeaderStatus::Client_UpdateDeviceCompact;
+    if (desc.nCaptureTimeUs != 0)
+        msg << desc.nCaptureTimeUs;
+    if (with_velocity)
+        msg << hvr::compact::EncodeVelocity(desc.vVel, desc.vAngVel);
+
+    auto pose = hvr::compact::EncodePose(desc.vPos, desc.vRot, with_velocity);
+    if (desc.nCaptureTimeUs != 0)
+        pose.nFlags |= hvr::compact::CompactFlags_HasTimestamp;
+    msg << pose;
+}
+
+// Applies a Client_UpdateDeviceCompact body on top of desc, velocities are zeroed if they weren't sent
+inline bool ReadCompactUpdate(const hvr::net::ByteView body, sDeviceNetPacket& desc)
+{
+    hvr::compact::sCompactBody compact;
+    if (!hvr::compact::ParseCompactBody(body, compact))
+        return false;
+
+    desc.vPos = compact.vPos;
+    desc.vRot = compact.qRot;
+    desc.vVel = compact.vVel;
+    desc.vAngVel = compact.vAngVel;
+    desc.nCaptureTimeUs = compact.nCaptureTimeUs;
+    return true;
+}
+
+// Datagrams on the udp fast path are the regular olc message header, followed by the id
+// the server handed out in Client_AssignID and a sequence number, followed by the message body.
+// Only device updates are accepted this way, everything else stays on tcp.
+struct sDatagramHeader {
+    olc::net::message_header<HeaderStatus> header;
+    uint32_t nUniqueID = 0;
+    // goes up by one for every datagram a sender sends, the server drops anything older than what it already has
+    uint32_t nSequence = 0;
+};
+
+// true if sequence a came after b, survives wrapping around
+inline bool SequenceNewer(const uint32_t a, const uint32_t b)
+{
+    return static_cast<int32_t>(a - b) > 0;
+}
+
+// a single update has to fit in one datagram
+static constexpr size_t k_nMaxDatagramSize = 1024;
+
+// One message in a shared memory ring, same thing a tcp message would carry, minus the copies
+struct sShmSlot {
+    HeaderStatus eHeader = HeaderStatus::Client_UpdateDevice;
+    uint32_t nSize = 0;
+    std::array<uint8_t, 512> aBody;
+};
+
+// the most devices one Client_UpdateDeviceBatch in a shared memory ring can carry
+static constexpr uint32_t k_nMaxShmBatch = 8;
+
+// One message in a shared memory channel. Unlike tcp there's no connection telling us who sent it,
+// so nUniqueID says which device it's for, same as in sDatagramHeader. A batch carries its own ids
+struct sShmRingSlot {
+    HeaderStatus eHeader = HeaderStatus::Client_UpdateDevice;
+    uint32_t nUniqueID = 0;
+    uint32_t nSize = 0;
+    std::array<uint8_t, sizeof(sDeviceNetPacket) * k_nMaxShmBatch + sizeof(uint32_t)> aBody;
+};
+
+// Per device shared memory channel for same-host clients.
+// The server creates it when asked with Client_RequestSharedMemory and answers with
+// Client_SharedMemoryReady, after that the client pushes its updates into the ring
+// instead of sending them over the socket. Registration still goes over tcp.
+struct sShmDeviceChannel {
+    hvr::shm::SpscRing<sShmRingSlot, 64> ring;
+};
+
+inline std::string ShmChannelName(const uint16_t nPort, const uint32_t nUniqueID)
+{
+    return "/hobovr_" + std::to_string(nPort) + "_" + std::to_string(nUniqueID);
+}
+
 #endif // #ifndef COMMON_HEADER_HELPER_HPP
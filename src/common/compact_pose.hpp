@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#ifndef COMPACT_POSE_HPP
+#define COMPACT_POSE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "hvr_math.hpp"
+#include "packet_view.hpp"
+
+// Compact pose wire format for Client_UpdateDeviceCompact.
+// Position is fixed point, rotation uses the "smallest three" encoding packed into 32 bits,
+// velocities and the capture time are optional blocks picked by flags. That's 17 bytes for a pose,
+// 29 with velocities, 37 with a timestamp on top, instead of the full 512 byte sDeviceNetPacket.
+namespace hvr::compact {
+
+// 0.1mm steps, covers +-214km
+static constexpr double k_fPositionScale = 10000.0;
+// 1mm/s and 1mrad/s steps, covers +-32m/s and +-32rad/s
+static constexpr double k_fVelocityScale = 1000.0;
+
+// 10 bits per quaternion component, 2 bits for the index of the dropped one
+static constexpr uint32_t k_nRotBits = 10;
+static constexpr uint32_t k_nRotMask = (1U << k_nRotBits) - 1;
+static constexpr double k_fRotRange = 0.70710678118654752440; // 1/sqrt(2)
+
+enum CompactFlags : uint8_t {
+    CompactFlags_HasVelocity = 1 << 0,
+    // a uint64_t capture time in server time comes before the velocity block
+    CompactFlags_HasTimestamp = 1 << 1,
+};
+
+#pragma pack(push, 1)
+struct sCompactPose {
+    int32_t aPos[3] = {};
+    uint32_t nRot = 0;
+    uint8_t nFlags = 0;
+};
+
+// follows sCompactPose when CompactFlags_HasVelocity is set
+struct sCompactVelocity {
+    int16_t aVel[3] = {};
+    int16_t aAngVel[3] = {};
+};
+#pragma pack(pop)
+
+inline int32_t QuantizePosition(const double value)
+{
+    return static_cast<int32_t>(std::lround(std::clamp(value * k_fPositionScale, -2147483647.0, 2147483647.0)));
+}
+
+inline double DequantizePosition(const int32_t value)
+{
+    return value / k_fPositionScale;
+}
+
+inline int16_t QuantizeVelocity(const double value)
+{
+    return static_cast<int16_t>(std::lround(std::clamp(value * k_fVelocityScale, -32767.0, 32767.0)));
+}
+
+inline double DequantizeVelocity(const int16_t value)
+{
+    return value / k_fVelocityScale;
+}
+
+// "smallest three": drop the largest component, it can be rebuilt from the unit length,
+// the remaining three are guaranteed to be within +-1/sqrt(2)
+inline uint32_t PackQuat(const hvr::math::quatd& q)
+{
+    const double comps[4] = { q.w, q.x, q.y, q.z };
+
+    uint32_t largest = 0;
+    for (uint32_t i = 1; i < 4; i++) {
+        if (std::abs(comps[i]) > std::abs(comps[largest]))
+            largest = i;
+    }
+
+    // q and -q are the same rotation, make the dropped one positive so we don't need its sign
+    const double sign = comps[largest] < 0 ? -1.0 : 1.0;
+
+    uint32_t packed = largest;
+    for (uint32_t i = 0; i < 4; i++) {
+        if (i == largest)
+            continue;
+
+        const double normalized = std::clamp(sign * comps[i] / k_fRotRange, -1.0, 1.0) * 0.5 + 0.5;
+        packed = (packed << k_nRotBits) | static_cast<uint32_t>(std::lround(normalized * k_nRotMask));
+    }
+
+    return packed;
+}
+
+inline hvr::math::quatd UnpackQuat(const uint32_t packed)
+{
+    const uint32_t largest = packed >> (3 * k_nRotBits);
+
+    double comps[4] = {};
+    double sum2 = 0;
+    int shift = 2 * k_nRotBits;
+    for (uint32_t i = 0; i < 4; i++) {
+        if (i == largest)
+            continue;
+
+        const double normalized = ((packed >> shift) & k_nRotMask) / static_cast<double>(k_nRotMask);
+        comps[i] = (normalized * 2.0 - 1.0) * k_fRotRange;
+        sum2 += comps[i] * comps[i];
+        shift -= k_nRotBits;
+    }
+    comps[largest] = std::sqrt(std::max(0.0, 1.0 - sum2));
+
+    return { comps[0], comps[1], comps[2], comps[3] };
+}
+
+inline sCompactPose EncodePose(const hvr::math::vec3d& pos, const hvr::math::quatd& rot, const bool with_velocity)
+{
+    sCompactPose out;
+    out.aPos[0] = QuantizePosition(pos.x);
+    out.aPos[1] = QuantizePosition(pos.y);
+    out.aPos[2] = QuantizePosition(pos.z);
+    out.nRot = PackQuat(rot);
+    out.nFlags = with_velocity ? CompactFlags_HasVelocity : 0;
+    return out;
+}
+
+inline sCompactVelocity EncodeVelocity(const hvr::math::vec3d& vel, const hvr::math::vec3d& ang_vel)
+{
+    sCompactVelocity out;
+    out.aVel[0] = QuantizeVelocity(vel.x);
+    out.aVel[1] = QuantizeVelocity(vel.y);
+    out.aVel[2] = QuantizeVelocity(vel.z);
+    out.aAngVel[0] = QuantizeVelocity(ang_vel.x);
+    out.aAngVel[1] = QuantizeVelocity(ang_vel.y);
+    out.aAngVel[2] = QuantizeVelocity(ang_vel.z);
+    return out;
+}
+
+// a whole Client_UpdateDeviceCompact body, dequantized. Velocities are zero and the capture time is 0 if they weren't sent
+struct sCompactBody {
+    hvr::math::vec3d vPos;
+    hvr::math::quatd qRot = { 1, 0, 0, 0 };
+    hvr::math::vec3d vVel;
+    hvr::math::vec3d vAngVel;
+    uint64_t nCaptureTimeUs = 0;
+};
+
+// The only reader of the layout, everything that takes a compact update goes through here.
+// Written with olc's <<, so it reads back to front: the pose, then the velocity block, then the timestamp
+inline bool ParseCompactBody(const hvr::net::ByteView body, sCompactBody& out)
+{
+    sCompactPose compact;
+    if (!body.Tail(sizeof(compact)).Read(0, compact))
+        return false;
+
+    sCompactVelocity vel;
+    const bool has_velocity = compact.nFlags & CompactFlags_HasVelocity;
+    if (has_velocity && !body.DropTail(sizeof(compact)).Tail(sizeof(vel)).Read(0, vel))
+        return false;
+
+    uint64_t capture_time = 0;
+    const auto before_velocity = body.DropTail(sizeof(compact) + (has_velocity ? sizeof(vel) : 0));
+    if ((compact.nFlags & CompactFlags_HasTimestamp) && !before_velocity.Tail(sizeof(capture_time)).Read(0, capture_time))
+        return false;
+
+    out.vPos = { DequantizePosition(compact.aPos[0]), DequantizePosition(compact.aPos[1]), DequantizePosition(compact.aPos[2]) };
+    out.qRot = UnpackQuat(compact.nRot);
+    out.vVel = {};
+    out.vAngVel = {};
+    out.nCaptureTimeUs = capture_time;
+
+    if (has_velocity) {
+        out.vVel = { DequantizeVelocity(vel.aVel[0]), DequantizeVelocity(vel.aVel[1]), DequantizeVelocity(vel.aVel[2]) };
+        out.vAngVel = { DequantizeVelocity(vel.aAngVel[0]), DequantizeVelocity(vel.aAngVel[1]), DequantizeVelocity(vel.aAngVel[2]) };
+    }
+
+    return true;
+}
+}
+
+#endif // #ifndef COMPACT_POSE_HPP
@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#ifndef DELTA_UPDATE_HPP
+#define DELTA_UPDATE_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+
+#include "common.hpp"
+
+// Delta encoding for Client_UpdateDeviceDelta.
+// sDeviceNetPacket is split into blocks, a delta carries a mask of the blocks that changed
+// since the last update the client sent, plus only those blocks in mask order.
+// A regular Client_UpdateDevice acts as a keyframe, clients send one every now and then
+// so the chain recovers from anything going sideways.
+// Deltas rely on ordered delivery, so they are rejected on the udp fast path.
+namespace hvr::delta {
+
+struct sDeltaBlock {
+    size_t nOffset;
+    size_t nSize;
+};
+
+static constexpr size_t k_nFloatBlockSize = 16;
+
+static constexpr std::array<sDeltaBlock, 11> k_aDeltaBlocks = { {
+    // type and role are next to each other
+    { offsetof(sDeviceNetPacket, eDeviceType), sizeof(DeviceType) + sizeof(DeviceRole) },
+    { offsetof(sDeviceNetPacket, vPos), sizeof(hvr::math::vec3d) },
+    { offsetof(sDeviceNetPacket, vVel), sizeof(hvr::math::vec3d) },
+    { offsetof(sDeviceNetPacket, vRot), sizeof(hvr::math::quatd) },
+    { offsetof(sDeviceNetPacket, vAngVel), sizeof(hvr::math::vec3d) },
+    { offsetof(sDeviceNetPacket, bBoolStates), sizeof(std::bitset<16>) },
+    // floats go in chunks, a trigger moving shouldn't resend all 64 of them
+    { offsetof(sDeviceNetPacket, aFloatStates) + 0 * k_nFloatBlockSize * sizeof(float), k_nFloatBlockSize * sizeof(float) },
+    { offsetof(sDeviceNetPacket, aFloatStates) + 1 * k_nFloatBlockSize * sizeof(float), k_nFloatBlockSize * sizeof(float) },
+    { offsetof(sDeviceNetPacket, aFloatStates) + 2 * k_nFloatBlockSize * sizeof(float), k_nFloatBlockSize * sizeof(float) },
+    { offsetof(sDeviceNetPacket, aFloatStates) + 3 * k_nFloatBlockSize * sizeof(float), k_nFloatBlockSize * sizeof(float) },
+    { offsetof(sDeviceNetPacket, nCaptureTimeUs), sizeof(uint64_t) },
+} };
+
+static_assert(k_aDeltaBlocks.size() <= 16, "change mask is only 16 bits");
+static_assert(offsetof(sDeviceNetPacket, eDeviceRole) == offsetof(sDeviceNetPacket, eDeviceType) + sizeof(DeviceType), "type and role have to be adjacent");
+
+// Builds a Client_UpdateDeviceDelta message with everything in cur that differs from base
+inline void WriteDeltaUpdate(olc::net::message<HeaderStatus>& msg, const sDeviceNetPacket& base, const sDeviceNetPacket& cur)
+{
+    const auto* base_bytes = reinterpret_cast<const uint8_t*>(&base);
+    const auto* cur_bytes = reinterpret_cast<const uint8_t*>(&cur);
+
+    msg.header.id = HeaderStatus::Client_UpdateDeviceDelta;
+
+    uint16_t mask = 0;
+    for (size_t i = 0; i < k_aDeltaBlocks.size(); i++) {
+        const auto& block = k_aDeltaBlocks[i];
+        if (std::memcmp(base_bytes + block.nOffset, cur_bytes + block.nOffset, block.nSize) == 0)
+            continue;
+
+        mask |= 1U << i;
+        msg.body.insert(msg.body.end(), cur_bytes + block.nOffset, cur_bytes + block.nOffset + block.nSize);
+    }
+
+    msg << mask;
+}
+
+// Applies a Client_UpdateDeviceDelta body on top of state, returns false if it's malformed
+inline bool ApplyDeltaUpdate(const hvr::net::ByteView body, sDeviceNetPacket& state)
+{
+    uint16_t mask = 0;
+    if (!body.Tail(sizeof(mask)).Read(0, mask))
+        return false;
+
+    const auto blocks = body.DropTail(sizeof(mask));
+
+    size_t expected = 0;
+    for (size_t i = 0; i < k_aDeltaBlocks.size(); i++) {
+        if (mask & (1U << i))
+            expected += k_aDeltaBlocks[i].nSize;
+    }
+    if (mask >> k_aDeltaBlocks.size() || blocks.size() != expected)
+        return false;
+
+    // blocks were appended in mask order, so walk them from the front
+    auto* state_bytes = reinterpret_cast<uint8_t*>(&state);
+    size_t read = 0;
+    for (size_t i = 0; i < k_aDeltaBlocks.size(); i++) {
+        if (!(mask & (1U << i)))
+            continue;
+
+        const auto& block = k_aDeltaBlocks[i];
+        std::memcpy(state_bytes + block.nOffset, blocks.data() + read, block.nSize);
+        read += block.nSize;
+    }
+
+    return true;
+}
+}
+
+#endif // #ifndef DELTA_UPDATE_HPP
@@ -111,11 +111,83 @@ inline constexpr auto operator+=(vec3<TL>& lhs, const vec3<TR>& rhs)
     return lhs;
 }
 
+template <class TL, class TR>
+inline constexpr auto operator-(const vec3<TL>& lhs, const vec3<TR>& rhs)
+{
+    return vec3(lhs.x - rhs.x, lhs.y - rhs.y, lhs.z - rhs.z);
+}
+
 template <class T>
 struct quat {
     T w, x, y, z;
 };
 
+template <class T>
+inline constexpr quat<T> operator*(const quat<T>& lhs, const quat<T>& rhs)
+{
+    return {
+        lhs.w * rhs.w - lhs.x * rhs.x - lhs.y * rhs.y - lhs.z * rhs.z,
+        lhs.w * rhs.x + lhs.x * rhs.w + lhs.y * rhs.z - lhs.z * rhs.y,
+        lhs.w * rhs.y - lhs.x * rhs.z + lhs.y * rhs.w + lhs.z * rhs.x,
+        lhs.w * rhs.z + lhs.x * rhs.y - lhs.y * rhs.x + lhs.z * rhs.w,
+    };
+}
+
+// the inverse, for unit quaternions
+template <class T>
+inline constexpr quat<T> conj(const quat<T>& q)
+{
+    return { q.w, -q.x, -q.y, -q.z };
+}
+
+template <class T>
+inline quat<T> normalize(const quat<T>& q)
+{
+    const T mag = std::sqrt(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+    if (mag <= 0)
+        return { 1, 0, 0, 0 };
+    return { q.w / mag, q.x / mag, q.y / mag, q.z / mag };
+}
+
+// rotation around v by |v| radians
+template <class T>
+inline quat<T> from_rotation_vector(const vec3<T>& v)
+{
+    const T angle = v.mag();
+    if (angle < static_cast<T>(1e-9))
+        return { 1, 0, 0, 0 };
+
+    const T s = std::sin(angle / 2) / angle;
+    return { std::cos(angle / 2), v.x * s, v.y * s, v.z * s };
+}
+
+// shortest path from a (t = 0) to b (t = 1)
+template <class T>
+inline quat<T> slerp(const quat<T>& a, quat<T> b, const T t)
+{
+    T cos_half = a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z;
+    if (cos_half < 0) {
+        b = { -b.w, -b.x, -b.y, -b.z };
+        cos_half = -cos_half;
+    }
+
+    // close enough that lerp does the same thing without dividing by ~0
+    if (cos_half > static_cast<T>(0.9995)) {
+        return normalize(quat<T> {
+            a.w + (b.w - a.w) * t,
+            a.x + (b.x - a.x) * t,
+            a.y + (b.y - a.y) * t,
+            a.z + (b.z - a.z) * t,
+        });
+    }
+
+    const T half = std::acos(cos_half);
+    const T sin_half = std::sin(half);
+    const T wa = std::sin((1 - t) * half) / sin_half;
+    const T wb = std::sin(t * half) / sin_half;
+    return { a.w * wa + b.w * wb, a.x * wa + b.x * wb, a.y * wa + b.y * wb, a.z * wa + b.z * wb };
+}
+
 using vec3f = vec3<float>;
 using vec3d = vec3<double>;
 using vec3i = vec3<int32_t>;
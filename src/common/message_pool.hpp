@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#ifndef MESSAGE_POOL_HPP
+#define MESSAGE_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "olcPGEX_Network.h"
+
+namespace hvr::net {
+
+// Recycles olc messages together with their body storage, once the pool is warm
+// building an outgoing message doesn't touch the allocator anymore.
+// That's only our side of it, connection::Send still copies the message into olc's own queue,
+// and olc allocates a body for every message it reads off tcp.
+// Not thread safe, every thread that builds messages keeps its own pool.
+template <class T>
+class MessagePool {
+public:
+    MessagePool(const size_t count, const size_t body_capacity)
+        : m_nBodyCapacity(body_capacity)
+    {
+        m_vFree.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            m_vFree.push_back(Make());
+        }
+    }
+
+    // the body comes back empty, but with at least body_capacity reserved
+    olc::net::message<T> Acquire()
+    {
+        if (m_vFree.empty()) {
+            m_nMisses++;
+            return Make();
+        }
+
+        auto msg = std::move(m_vFree.back());
+        m_vFree.pop_back();
+        return msg;
+    }
+
+    void Release(olc::net::message<T>&& msg)
+    {
+        // the free list never grows past what we reserved up front, extras just get freed
+        if (m_vFree.size() == m_vFree.capacity())
+            return;
+
+        msg.header = {};
+        msg.body.clear();
+        m_vFree.push_back(std::move(msg));
+    }
+
+    // how often Acquire had to allocate, it should stop going up once streaming settles
+    uint64_t Misses() const
+    {
+        return m_nMisses;
+    }
+
+private:
+    olc::net::message<T> Make() const
+    {
+        olc::net::message<T> msg;
+        msg.body.reserve(m_nBodyCapacity);
+        return msg;
+    }
+
+    size_t m_nBodyCapacity;
+    std::vector<olc::net::message<T>> m_vFree;
+    uint64_t m_nMisses = 0;
+};
+
+}
+
+#endif // #ifndef MESSAGE_POOL_HPP
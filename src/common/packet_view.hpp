@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#ifndef PACKET_VIEW_HPP
+#define PACKET_VIEW_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace hvr::net {
+
+// Read-only, bounds checked window into bytes we received, a message body,
+// a shared memory slot, a batch entry. Nothing gets copied until a field is read.
+class ByteView {
+public:
+    constexpr ByteView() = default;
+
+    constexpr ByteView(const uint8_t* data, const size_t size)
+        : m_data(data)
+        , m_size(size)
+    {
+    }
+
+    explicit ByteView(const std::vector<uint8_t>& bytes)
+        : m_data(bytes.data())
+        , m_size(bytes.size())
+    {
+    }
+
+    inline const uint8_t* data() const
+    {
+        return m_data;
+    }
+
+    inline size_t size() const
+    {
+        return m_size;
+    }
+
+    inline bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    // empty view if the range doesn't fit
+    inline ByteView Slice(const size_t offset, const size_t length) const
+    {
+        if (offset > m_size || length > m_size - offset)
+            return {};
+
+        return { m_data + offset, length };
+    }
+
+    // olc messages are stacks, the last thing pushed sits at the back
+    inline ByteView Tail(const size_t length) const
+    {
+        if (length > m_size)
+            return {};
+
+        return { m_data + m_size - length, length };
+    }
+
+    inline ByteView DropTail(const size_t length) const
+    {
+        if (length > m_size)
+            return {};
+
+        return { m_data, m_size - length };
+    }
+
+    template <class T>
+    inline bool Read(const size_t offset, T& out) const
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "can only read trivially copyable types out of a buffer");
+        if (offset > m_size || sizeof(T) > m_size - offset)
+            return false;
+
+        // memcpy, the bytes aren't necessarily aligned for T
+        std::memcpy(&out, m_data + offset, sizeof(T));
+        return true;
+    }
+
+private:
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+};
+
+}
+
+#endif // #ifndef PACKET_VIEW_HPP
@@ -0,0 +1,190 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#ifndef SHM_RING_HPP
+#define SHM_RING_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // #ifndef _WIN32
+
+namespace hvr::shm {
+
+// Lock free single producer single consumer ring.
+// It lives entirely inside a shared memory segment, so no pointers in here,
+// and the indices only ever grow, wrapping is handled by the mask
+template <class T, uint32_t N>
+struct SpscRing {
+    static_assert((N & (N - 1)) == 0, "ring size has to be a power of 2");
+    static_assert(std::atomic<uint32_t>::is_always_lock_free, "ring indices have to be lock free to be shared between processes");
+
+    // written by the producer only
+    alignas(64) std::atomic<uint32_t> nHead = 0;
+    // written by the consumer only
+    alignas(64) std::atomic<uint32_t> nTail = 0;
+
+    alignas(64) std::array<T, N> aSlots;
+
+    // producer side, returns false if the consumer fell behind and the ring is full
+    inline bool Push(const T& item)
+    {
+        const uint32_t head = nHead.load(std::memory_order_relaxed);
+        if (head - nTail.load(std::memory_order_acquire) == N)
+            return false;
+
+        aSlots[head & (N - 1)] = item;
+        nHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, oldest item without copying it out of the ring, nullptr when empty
+    inline const T* Front() const
+    {
+        const uint32_t tail = nTail.load(std::memory_order_relaxed);
+        if (tail == nHead.load(std::memory_order_acquire))
+            return nullptr;
+
+        return &aSlots[tail & (N - 1)];
+    }
+
+    // consumer side, releases the slot returned by Front()
+    inline void Pop()
+    {
+        nTail.store(nTail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    inline uint32_t Count() const
+    {
+        return nHead.load(std::memory_order_acquire) - nTail.load(std::memory_order_acquire);
+    }
+};
+
+// Owns a named POSIX shared memory segment holding a single T.
+// The creating side also unlinks the name when it goes away.
+template <class T>
+class SharedObject {
+public:
+    SharedObject() = default;
+    SharedObject(const SharedObject&) = delete;
+    SharedObject& operator=(const SharedObject&) = delete;
+
+    ~SharedObject()
+    {
+        Close();
+    }
+
+    bool Create(const std::string& name)
+    {
+#ifndef _WIN32
+        // a previous crash might have left a stale segment behind
+        shm_unlink(name.c_str());
+
+        const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0)
+            return false;
+
+        if (ftruncate(fd, sizeof(T)) != 0) {
+            close(fd);
+            shm_unlink(name.c_str());
+            return false;
+        }
+
+        if (!Map(fd)) {
+            shm_unlink(name.c_str());
+            return false;
+        }
+
+        new (m_ptr) T();
+        m_name = name;
+        m_owner = true;
+        return true;
+#else
+        return false;
+#endif // #ifndef _WIN32
+    }
+
+    bool Open(const std::string& name)
+    {
+#ifndef _WIN32
+        const int fd = shm_open(name.c_str(), O_RDWR, 0600);
+        if (fd < 0)
+            return false;
+
+        struct stat st { };
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(T)) {
+            close(fd);
+            return false;
+        }
+
+        if (!Map(fd))
+            return false;
+
+        m_name = name;
+        m_owner = false;
+        return true;
+#else
+        return false;
+#endif // #ifndef _WIN32
+    }
+
+    void Close()
+    {
+#ifndef _WIN32
+        if (!m_ptr)
+            return;
+
+        munmap(m_ptr, sizeof(T));
+        if (m_owner)
+            shm_unlink(m_name.c_str());
+#endif // #ifndef _WIN32
+        m_ptr = nullptr;
+        m_owner = false;
+        m_name.clear();
+    }
+
+    inline T* get() const
+    {
+        return m_ptr;
+    }
+
+    inline T* operator->() const
+    {
+        return m_ptr;
+    }
+
+    inline explicit operator bool() const
+    {
+        return m_ptr != nullptr;
+    }
+
+private:
+#ifndef _WIN32
+    bool Map(const int fd)
+    {
+        void* ptr = mmap(nullptr, sizeof(T), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        // the mapping keeps the segment alive, we don't need the fd anymore
+        close(fd);
+        if (ptr == MAP_FAILED)
+            return false;
+
+        m_ptr = static_cast<T*>(ptr);
+        return true;
+    }
+#endif // #ifndef _WIN32
+
+    T* m_ptr = nullptr;
+    std::string m_name;
+    bool m_owner = false;
+};
+
+}
+
+#endif // #ifndef SHM_RING_HPP
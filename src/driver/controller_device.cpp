@@ -4,6 +4,9 @@
 
 #include "driver_vrmath.h"
 #include "driverlog.h"
+#include "pose_decode.hpp"
+
+#include <algorithm>
 
 // Let's create some variables for strings used in getting settings.
 // This is the section where all of the settings we want are stored. A section name can be anything,
@@ -14,7 +17,7 @@ static const char* my_tracker_main_settings_section = "driver_simpletrackers";
 // These are the keys we want to retrieve the values for in the settings
 static const char* my_tracker_settings_key_model_number = "mytracker_model_number";
 
-MyControllerDeviceDriver::MyControllerDeviceDriver(unsigned int my_tracker_id, const DeviceRole my_role)
+MyControllerDeviceDriver::MyControllerDeviceDriver(unsigned int my_tracker_id, const DeviceRole my_role, const DeviceType my_type)
 {
     // Set a member to keep track of whether we've activated yet or not
 
@@ -22,6 +25,8 @@ MyControllerDeviceDriver::MyControllerDeviceDriver(unsigned int my_tracker_id, c
 
     // The constructor takes a role argument, that gives us information about if our controller is a left or right hand.
     // Let's store it for later use. We'll need it.
+    my_type_ = my_type;
+    my_role_ = my_role;
     my_controller_role_ = toVr(my_role);
 
     // We have our model number and serial number stored in SteamVR settings. We need to get them and do so here.
@@ -30,7 +35,7 @@ MyControllerDeviceDriver::MyControllerDeviceDriver(unsigned int my_tracker_id, c
     // char model_number[1024];
     // vr::VRSettings()->GetString(
     //     my_tracker_main_settings_section, my_tracker_settings_key_model_number, model_number, sizeof(model_number));
-    my_device_model_number_ = "asiotest_controller";
+    my_device_model_number_ = my_type_ == DeviceType::ControllerIndexLike ? "asiotest_index_controller" : "asiotest_controller";
 
     // Emulate a serial number by appending the internal tracker id we are given by our implementation of
     // IServerTrackedDeviceProvider
@@ -76,7 +81,8 @@ vr::EVRInitError MyControllerDeviceDriver::Activate(uint32_t unObjectId)
     // As well as what default bindings should be for legacy apps.
     // Note, we can use the wildcard {<driver_name>} to match the root folder location
     // of our driver.
-    vr::VRProperties()->SetStringProperty(container, vr::Prop_InputProfilePath_String, "{asiotest}/input/mycontroller_profile.json");
+    vr::VRProperties()->SetStringProperty(container, vr::Prop_InputProfilePath_String,
+        my_type_ == DeviceType::ControllerIndexLike ? "{asiotest}/input/myindexcontroller_profile.json" : "{asiotest}/input/mycontroller_profile.json");
 
     // Let's set up handles for all of our components.
     // Even though these are also defined in our input profile,
@@ -96,6 +102,18 @@ vr::EVRInitError MyControllerDeviceDriver::Activate(uint32_t unObjectId)
     vr::VRDriverInput()->CreateScalarComponent(container, "/input/trigger/value", &input_handles_[MyControllerComponent_trigger_value], vr::VRScalarType_Absolute, vr::VRScalarUnits_NormalizedOneSided);
     vr::VRDriverInput()->CreateBooleanComponent(container, "/input/trigger/click", &input_handles_[MyControllerComponent_trigger_click]);
 
+    // where the client's bBoolStates and aFloatStates end up, hProcessMsg only passes on what changed
+    input_mapper_.AddBoolean(input_handles_[MyControllerComponent_a_click], InputBit_AClick);
+    input_mapper_.AddBoolean(input_handles_[MyControllerComponent_a_touch], InputBit_ATouch);
+    input_mapper_.AddBoolean(input_handles_[MyControllerComponent_trigger_click], InputBit_TriggerClick);
+    input_mapper_.AddScalar(input_handles_[MyControllerComponent_trigger_value], InputFloat_Trigger);
+    // new handles, nothing we remember about the old ones applies
+    input_mapper_.Invalidate();
+
+    // The Index-like one has a hand skeleton on top, driven by the finger curls and splays in aFloatStates
+    if (my_type_ == DeviceType::ControllerIndexLike)
+        skeleton_.Create(container, my_role_);
+
     // Let's create our haptic component.
     // These are global across the device, and you can only have one per device.
     vr::VRDriverInput()->CreateHapticComponent(container, "/output/haptic", &input_handles_[MyControllerComponent_haptic]);
@@ -227,71 +245,30 @@ void MyControllerDeviceDriver::Deactivate()
 
     // unassign our controller index (we don't want to be calling vrserver anymore after Deactivate() has been called
     my_device_index_ = vr::k_unTrackedDeviceIndexInvalid;
+    input_mapper_.Clear();
+    skeleton_.Clear();
 }
 
 void MyControllerDeviceDriver::hTurnOff()
 {
-    vr::DriverPose_t pose = { 0 };
-
-    // The pose we provided is valid.
-    // This should be set is
-    pose.poseIsValid = true;
-
-    // Our device is always connected.
-    // In reality with physical devices, when they get disconnected,
-    // set this to false and icons in SteamVR will be updated to show the device is disconnected
-    pose.deviceIsConnected = false;
-
-    // The state of our tracking. For our virtual device, it's always going to be ok,
-    // but this can get set differently to inform the runtime about the state of the device's tracking
-    // and update the icons to inform the user accordingly.
-    pose.result = vr::TrackingResult_Running_OK;
-
-    // Inform the vrserver that our tracked device's pose has updated, giving it the pose returned by our GetPose().
-    vr::VRServerDriverHost()->TrackedDevicePoseUpdated(my_device_index_, pose, sizeof(pose));
+    // the publisher tells vrserver
+    is_on_ = false;
 }
 
 void MyControllerDeviceDriver::hTurnOn()
 {
-    vr::DriverPose_t pose = { 0 };
-
-    // The pose we provided is valid.
-    // This should be set is
-    pose.poseIsValid = true;
-
-    // Our device is always connected.
-    // In reality with physical devices, when they get disconnected,
-    // set this to false and icons in SteamVR will be updated to show the device is disconnected
-    pose.deviceIsConnected = true;
-
-    // The state of our tracking. For our virtual device, it's always going to be ok,
-    // but this can get set differently to inform the runtime about the state of the device's tracking
-    // and update the icons to inform the user accordingly.
-    pose.result = vr::TrackingResult_Running_OK;
-
-    // Inform the vrserver that our tracked device's pose has updated, giving it the pose returned by our GetPose().
-    vr::VRServerDriverHost()->TrackedDevicePoseUpdated(my_device_index_, pose, sizeof(pose));
-}
-
-//-----------------------------------------------------------------------------
-// Purpose: This is called by our IServerTrackedDeviceProvider when its RunFrame() method gets called.
-// It's not part of the ITrackedDeviceServerDriver interface, we created it ourselves.
-//-----------------------------------------------------------------------------
-void MyControllerDeviceDriver::MyRunFrame()
-{
-    // update our inputs here
-    vr::VRDriverInput()->UpdateBooleanComponent(input_handles_[MyControllerComponent_a_click], false, 0);
-    vr::VRDriverInput()->UpdateBooleanComponent(input_handles_[MyControllerComponent_a_touch], false, 0);
-
-    vr::VRDriverInput()->UpdateBooleanComponent(input_handles_[MyControllerComponent_trigger_click], false, 0);
-    vr::VRDriverInput()->UpdateScalarComponent(input_handles_[MyControllerComponent_trigger_value], 0.f, 0);
+    // the publisher tells vrserver
+    is_on_ = true;
+    // a new client, vrserver still has the buttons of the last one
+    input_mapper_.Invalidate();
+    skeleton_.Invalidate();
 }
 
 //-----------------------------------------------------------------------------
 // Purpose: This is called by our IServerTrackedDeviceProvider when it pops an event off the event queue.
 // It's not part of the ITrackedDeviceServerDriver interface, we created it ourselves.
 //-----------------------------------------------------------------------------
-void MyControllerDeviceDriver::hProcessEvent(const vr::VREvent_t& vrevent)
+bool MyControllerDeviceDriver::hProcessEvent(const vr::VREvent_t& vrevent)
 {
     switch (vrevent.eventType) {
     // Listen for haptic events
@@ -301,49 +278,65 @@ void MyControllerDeviceDriver::hProcessEvent(const vr::VREvent_t& vrevent)
 
         if (vrevent.data.hapticVibration.componentHandle == input_handles_[MyControllerComponent_haptic]) {
             // The event was intended for us!
-            // To convert the data to a pulse, see the docs.
-            // For this driver, we'll just print the values.
-
-            float duration = vrevent.data.hapticVibration.fDurationSeconds;
-            float frequency = vrevent.data.hapticVibration.fFrequency;
-            float amplitude = vrevent.data.hapticVibration.fAmplitude;
-
-            DriverLog("Haptic event triggered for %s hand. Duration: %.2f, Frequency: %.2f, Amplitude: %.2f", my_controller_role_ == vr::TrackedControllerRole_LeftHand ? "left" : "right",
-                duration, frequency, amplitude);
+            // The client behind us gets it after this frame's events are through, see hTakeHaptic.
+            const float duration = vrevent.data.hapticVibration.fDurationSeconds;
+            const float frequency = vrevent.data.hapticVibration.fFrequency;
+            const float amplitude = vrevent.data.hapticVibration.fAmplitude;
+            const uint64_t age = static_cast<uint64_t>(std::max(vrevent.eventAgeSeconds, 0.f) * 1000000.0);
+
+            if (!has_haptic_) {
+                pending_haptic_ = { 0, duration, frequency, amplitude, hvr::clock::NowMicros() - age };
+                has_haptic_ = true;
+                return true;
+            }
+
+            // a game firing pulses back to back gets one, the strongest one's frequency wins
+            if (amplitude > pending_haptic_.fAmplitude) {
+                pending_haptic_.fAmplitude = amplitude;
+                pending_haptic_.fFrequency = frequency;
+            }
+            pending_haptic_.fDurationSeconds = std::max(pending_haptic_.fDurationSeconds, duration);
+            return true;
         }
         break;
     }
     default:
         break;
     }
+    return false;
+}
+
+void MyControllerDeviceDriver::hGetEventInterests(std::vector<sEventInterest>& interests)
+{
+    // only haptics for our own component, it's there once we're activated
+    const auto haptic = input_handles_[MyControllerComponent_haptic];
+    if (haptic != vr::k_ulInvalidInputComponentHandle)
+        interests.push_back({ vr::VREvent_Input_HapticVibration, sEventInterest::Match::Component, haptic });
+}
+
+bool MyControllerDeviceDriver::hTakeHaptic(sHapticPulse& pulse)
+{
+    if (!has_haptic_)
+        return false;
+
+    pulse = pending_haptic_;
+    has_haptic_ = false;
+    return true;
 }
 
 //-----------------------------------------------------------------------------
 // Purpose: Meh idk, ipc update
 //-----------------------------------------------------------------------------
-void MyControllerDeviceDriver::hProcessMsg(olc::net::message<HeaderStatus>& msg)
+void MyControllerDeviceDriver::hProcessMsg(const HeaderStatus id, const hvr::net::ByteView body, const sSkippedButtons& skipped)
 {
-    sDeviceNetPacket desc;
-    msg >> desc;
-
     vr::DriverPose_t pose = { 0 };
-    // copy our position to our pose
-    pose.vecPosition[0] = desc.vPos.x - 3;
-    pose.vecPosition[1] = desc.vPos.y;
-    pose.vecPosition[2] = desc.vPos.z - 3;
-
-    pose.vecVelocity[0] = desc.vVel.x;
-    pose.vecVelocity[1] = desc.vVel.y;
-    pose.vecVelocity[2] = desc.vVel.z;
-
-    pose.qRotation.w = desc.vRot.w;
-    pose.qRotation.x = desc.vRot.x;
-    pose.qRotation.y = desc.vRot.y;
-    pose.qRotation.z = desc.vRot.z;
+    if (!DecodeDevicePose(id, body, pose)) {
+        return;
+    }
 
-    pose.vecAngularVelocity[0] = desc.vAngVel.x;
-    pose.vecAngularVelocity[1] = desc.vAngVel.y;
-    pose.vecAngularVelocity[2] = desc.vAngVel.z;
+    // the demo client spawns its devices at (3, 0, 3)
+    pose.vecPosition[0] -= 3;
+    pose.vecPosition[2] -= 3;
 
     // The pose we provided is valid.
     // This should be set is
@@ -359,8 +352,23 @@ void MyControllerDeviceDriver::hProcessMsg(olc::net::message<HeaderStatus>& msg)
     // and update the icons to inform the user accordingly.
     pose.result = vr::TrackingResult_Running_OK;
 
-    // Inform the vrserver that our tracked device's pose has updated, giving it the pose returned by our GetPose().
-    vr::VRServerDriverHost()->TrackedDevicePoseUpdated(my_device_index_, pose, sizeof(pose));
+    // inputs go out right away, with the same time offset as the pose they came with
+    input_mapper_.Update(id, body, pose.poseTimeOffset, skipped);
+    skeleton_.Update(id, body);
+
+    // The publisher thread picks it up from here, only the newest one gets to vrserver.
+    pose_slot_.Write(pose, hvr::clock::NowMicros());
+}
+
+void MyControllerDeviceDriver::hPublish()
+{
+    // a warm device sits in the pool disconnected until a client takes it
+    pose_pipeline_.Publish(my_device_index_, is_on_, pose_slot_);
+}
+
+void MyControllerDeviceDriver::hSetPoseSettings(const sPoseSettings& settings)
+{
+    pose_pipeline_.Configure(settings, pose_slot_);
 }
 
 //-----------------------------------------------------------------------------
@@ -374,5 +382,10 @@ const std::string& MyControllerDeviceDriver::hGetSerialNumber()
 
 DeviceType MyControllerDeviceDriver::hGetDeviceType()
 {
-    return DeviceType::ControllerViveLike;
+    return my_type_;
+}
+
+DeviceRole MyControllerDeviceDriver::hGetDeviceRole()
+{
+    return my_role_;
 }
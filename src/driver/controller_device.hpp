@@ -2,6 +2,9 @@
 
 #pragma once
 
+#include "hand_skeleton.hpp"
+#include "input_mapper.hpp"
+#include "pose_slot.hpp"
 #include "tracked_device_interfaces.hpp"
 
 #include <array>
@@ -22,7 +25,8 @@ enum MyControllerComponent {
 
 class MyControllerDeviceDriver : public IHvrTrackedDevice {
 public:
-    MyControllerDeviceDriver(unsigned int my_controller_id, const DeviceRole my_role);
+    // ControllerViveLike or ControllerIndexLike, the Index-like one also has a hand skeleton
+    MyControllerDeviceDriver(unsigned int my_controller_id, const DeviceRole my_role, const DeviceType my_type = DeviceType::ControllerViveLike);
 
     vr::EVRInitError Activate(uint32_t unObjectId) override;
 
@@ -40,24 +44,41 @@ public:
 
     const std::string& hGetSerialNumber() override;
 
-    void MyRunFrame();
-    void hProcessEvent(const vr::VREvent_t& vrevent) override;
-    void hProcessMsg(olc::net::message<HeaderStatus>& msg) override;
+    bool hProcessEvent(const vr::VREvent_t& vrevent) override;
+    bool hTakeHaptic(sHapticPulse& pulse) override;
+    void hGetEventInterests(std::vector<sEventInterest>& interests) override;
+    void hProcessMsg(const HeaderStatus id, const hvr::net::ByteView body, const sSkippedButtons& skipped) override;
+    void hPublish() override;
+    void hSetPoseSettings(const sPoseSettings& settings) override;
     void hTurnOff() override;
     void hTurnOn() override;
     DeviceType hGetDeviceType() override;
+    DeviceRole hGetDeviceRole() override;
 
     void MyPoseUpdateThread();
 
 private:
     unsigned int my_controller_id_;
 
-    std::atomic<vr::TrackedDeviceIndex_t> my_device_index_;
+    std::atomic<vr::TrackedDeviceIndex_t> my_device_index_ { vr::k_unTrackedDeviceIndexInvalid };
+    std::atomic<bool> is_on_ { true };
 
+    PoseSlot pose_slot_;
+    PosePipeline pose_pipeline_;
+
+    DeviceType my_type_;
+    DeviceRole my_role_;
     vr::ETrackedControllerRole my_controller_role_;
 
     std::string my_device_model_number_;
     std::string my_device_serial_number_;
 
-    std::array<vr::VRInputComponentHandle_t, MyControllerComponent_MAX> input_handles_;
+    // all invalid until Activate
+    std::array<vr::VRInputComponentHandle_t, MyControllerComponent_MAX> input_handles_ = {};
+
+    // what hProcessEvent collected this frame, only touched on vrserver's RunFrame thread
+    sHapticPulse pending_haptic_;
+    bool has_haptic_ = false;
+    InputMapper input_mapper_;
+    HandSkeleton skeleton_;
 };
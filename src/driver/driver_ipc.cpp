@@ -2,12 +2,129 @@
 
 #include "driver_ipc.hpp"
 #include "controller_device.hpp"
+#include "delta_update.hpp"
 #include "driver_tracked_device.h"
 #include "driverlog.h"
 
-IpcServer::IpcServer(uint16_t nPort)
-    : olc::net::server_interface<HeaderStatus>(nPort)
+#include <algorithm>
+#include <cstring>
+#include <random>
+
+namespace {
+
+// controllers are pooled per hand, everything else doesn't care about the role
+uint16_t PoolKey(const DeviceType type, const DeviceRole role)
 {
+    const bool handed = toVr(type) == vr::TrackedDeviceClass_Controller;
+    return static_cast<uint16_t>(static_cast<uint16_t>(type) << 8 | static_cast<uint8_t>(handed ? role : DeviceRole::Neither));
+}
+
+uint64_t NewResumeToken()
+{
+    static thread_local std::mt19937_64 rng(std::random_device {}());
+    uint64_t token = 0;
+    while (token == 0) {
+        token = rng();
+    }
+    return token;
+}
+
+}
+
+IpcServer::sIpcConnection::sIpcConnection(asio::io_context& work_context, asio::io_context& net_context, std::shared_ptr<IpcConnection> client, const size_t max_queued)
+    : connection(std::move(client))
+    , strand(asio::make_strand(work_context))
+    , writer(std::make_shared<SharedWriter>(asio::make_strand(net_context), connection, max_queued))
+    , pool(16, sizeof(sDeviceNetPacket) + sizeof(uint32_t))
+{
+    // built on olc's thread, the only one that touches the socket
+    asio::error_code ec;
+    const auto endpoint = connection->Socket().remote_endpoint(ec);
+    if (!ec)
+        peer = endpoint.address();
+}
+
+IpcServer::IpcServer(const sIpcSettings& settings)
+    : olc::net::server_interface<HeaderStatus>(settings.nPort)
+    , m_work_guard(asio::make_work_guard(m_work_context))
+    , m_settings(settings)
+    , m_udp_socket(m_work_context, asio::ip::udp::endpoint(asio::ip::udp::v4(), settings.nPort))
+{
+    // the udp socket is all ours, it gets serviced by the workers once StartWorkers() is called
+    ReceiveDatagram();
+}
+
+IpcServer::~IpcServer()
+{
+    // stop the asio threads before our own sockets go away
+    Shutdown();
+}
+
+bool IpcServer::Start()
+{
+    // one thread and no more, see m_work_context
+    AcceptNext();
+    m_threadContext = std::thread([this]() { m_asioContext.run(); });
+    DriverLog("Listening on port %s", std::to_string(m_settings.nPort).c_str());
+    return true;
+}
+
+void IpcServer::AcceptNext()
+{
+    m_asioAcceptor.async_accept([this](std::error_code ec, asio::ip::tcp::socket socket) {
+        if (ec) {
+            DriverLog("Accept failed: %s", ec.message().c_str());
+        } else {
+            auto client = std::make_shared<IpcConnection>(olc::net::connection<HeaderStatus>::owner::server, m_asioContext, std::move(socket), m_qMessagesIn);
+            if (OnClientConnect(client)) {
+                {
+                    std::lock_guard lock(m_connections_mutex);
+                    m_deqConnections.push_back(client);
+                }
+                client->ConnectToClient(this, nIDCounter++);
+            }
+        }
+
+        AcceptNext();
+    });
+}
+
+void IpcServer::StartWorkers()
+{
+    int32_t count = m_settings.nWorkerThreads;
+    if (count <= 0)
+        count = std::max(1U, std::thread::hardware_concurrency());
+
+    for (int32_t i = 0; i < count; i++) {
+        m_vWorkers.emplace_back([this]() { m_work_context.run(); });
+    }
+    DriverLog("Running ipc on %s worker threads", std::to_string(count).c_str());
+}
+
+void IpcServer::StartPublisher()
+{
+    m_bPublishing = true;
+    m_publisher = std::thread(&IpcServer::PublishPoses, this);
+}
+
+void IpcServer::Shutdown()
+{
+    Stop();
+    m_work_guard.reset();
+    m_work_context.stop();
+    for (auto& worker : m_vWorkers) {
+        if (worker.joinable())
+            worker.join();
+    }
+    m_vWorkers.clear();
+
+    if (m_bPublishing.exchange(false)) {
+        {
+            std::lock_guard lock(m_publish_mutex);
+            m_publish_cv.notify_one();
+        }
+        m_publisher.join();
+    }
 }
 
 bool IpcServer::OnClientConnect(std::shared_ptr<olc::net::connection<HeaderStatus>> client)
@@ -18,73 +135,322 @@ bool IpcServer::OnClientConnect(std::shared_ptr<olc::net::connection<HeaderStatu
 
 void IpcServer::OnClientValidated(std::shared_ptr<olc::net::connection<HeaderStatus>> client)
 {
+    // every connection comes out of AcceptNext
+    const auto conn = std::make_shared<sIpcConnection>(m_work_context, m_asioContext, std::static_pointer_cast<IpcConnection>(client), static_cast<size_t>(std::max(m_settings.nMaxQueuedMessages, 1)));
+    {
+        std::unique_lock lock(m_clients_mutex);
+        m_mapConnections.insert_or_assign(client->GetID(), conn);
+    }
+
     // Client passed validation check, so send them a message informing
     // them they can continue to communicate
     olc::net::message<HeaderStatus> msg;
     msg.header.id = HeaderStatus::Client_Accepted;
-    client->Send(msg);
+    conn->writer->Send(MakeSharedMessage(msg));
 }
 
 void IpcServer::OnClientDisconnect(std::shared_ptr<olc::net::connection<HeaderStatus>> client)
 {
-    if (client) {
-        if (m_mapPlayerRoster.find(client->GetID()) == m_mapPlayerRoster.end()) {
+    if (!client)
+        return;
+
+    uint64_t token = 0;
+    {
+        std::unique_lock lock(m_clients_mutex);
+        const auto res = m_mapConnections.find(client->GetID());
+        if (res != m_mapConnections.end()) {
+            m_nDroppedOutgoing += res->second->writer->Dropped();
+            token = res->second->nResumeToken;
+            m_mapConnections.erase(res);
+        }
+        if (m_mapClients.erase(client->GetID()) == 0) {
             // client never added to roster, so just let it disappear
-        } else {
-            auto& pd = m_mapPlayerRoster[client->GetID()];
-            DriverLog("[UNGRACEFUL REMOVAL]: %s", std::to_string(pd.nUniqueID).c_str());
-            m_mapPlayerRoster.erase(client->GetID());
-            m_vGarbageIDs.push_back(client->GetID());
-            OnDeviceRemove(client->GetID());
+            return;
         }
     }
+
+    {
+        std::lock_guard lock(m_shm_mutex);
+        m_vClosedShmChannels.push_back(client->GetID());
+    }
+
+    // take every device the connection registered down with it
+    std::vector<uint32_t> pids;
+    std::vector<sDeviceNetPacket> descs;
+    {
+        std::unique_lock lock(m_roster_mutex);
+        for (auto it = m_mapPlayerRoster.begin(); it != m_mapPlayerRoster.end();) {
+            if (ConnectionOf(it->first) == client->GetID()) {
+                pids.push_back(it->first);
+                descs.push_back(it->second);
+                it = m_mapPlayerRoster.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    if (token != 0 && m_settings.nResumeTimeoutMs > 0) {
+        // keep the devices around for a while, the client might just be on a flaky link
+        sSuspendedSession session;
+        session.expires = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_settings.nResumeTimeoutMs);
+        for (size_t i = 0; i < pids.size(); i++) {
+            DriverLog("[SUSPENDED]: %s", std::to_string(pids[i]).c_str());
+            session.devices.emplace(SubIndexOf(pids[i]), sSuspendedDevice { descs[i], DetachDevice(pids[i]) });
+        }
+
+        std::optional<sSuspendedSession> replaced;
+        {
+            std::lock_guard lock(m_sessions_mutex);
+            auto old = m_mapSuspendedSessions.extract(token);
+            if (old)
+                replaced = std::move(old.mapped());
+            m_mapSuspendedSessions.emplace(token, std::move(session));
+        }
+        // someone else went away with the same token before, their devices are up for grabs now
+        if (replaced) {
+            for (auto& [sub, suspended] : replaced->devices) {
+                ParkDevice(std::move(suspended.device));
+            }
+        }
+    } else {
+        for (auto pid : pids) {
+            DriverLog("[UNGRACEFUL REMOVAL]: %s", std::to_string(pid).c_str());
+            OnDeviceRemove(pid);
+        }
+    }
+
+    std::lock_guard lock(m_garbage_mutex);
+    m_vGarbageIDs.insert(m_vGarbageIDs.end(), pids.begin(), pids.end());
 }
 
 void IpcServer::OnMessage(std::shared_ptr<olc::net::connection<HeaderStatus>> client, olc::net::message<HeaderStatus>& msg)
 {
-    if (!m_vGarbageIDs.empty()) {
-        for (auto pid : m_vGarbageIDs) {
-            olc::net::message<HeaderStatus> m;
-            m.header.id = HeaderStatus::Client_RemoveDevice;
-            m << pid;
-            DriverLog("Removing %lu", pid);
-            MessageAllClients(m);
-        }
-        m_vGarbageIDs.clear();
+    // as close to the receive as we get, olc doesn't timestamp its incoming queue. See sPingPayload for what that costs
+    const uint64_t received = hvr::clock::NowMicros();
+    m_nMessagesIn++;
+
+    std::vector<uint32_t> garbage;
+    {
+        std::lock_guard lock(m_garbage_mutex);
+        garbage.swap(m_vGarbageIDs);
+    }
+    for (auto pid : garbage) {
+        olc::net::message<HeaderStatus> m;
+        m.header.id = HeaderStatus::Client_RemoveDevice;
+        m << pid;
+        DriverLog("Removing %lu", pid);
+        MessageSubscribers(MakeSharedMessage(m), Subscribe_DeviceRemove);
+    }
+
+    std::shared_ptr<sIpcConnection> conn;
+    {
+        std::shared_lock lock(m_clients_mutex);
+        const auto res = m_mapConnections.find(client->GetID());
+        if (res == m_mapConnections.end())
+            return;
+        conn = res->second;
     }
 
+    // poses skip the queue, only the newest one per device gets looked at
+    switch (msg.header.id) {
+    case HeaderStatus::Client_UpdateDevice:
+    case HeaderStatus::Client_UpdateDeviceCompact:
+    case HeaderStatus::Client_UpdateDeviceDelta:
+        EnqueueDeviceUpdate(conn, client->GetID(), msg.header.id, hvr::net::ByteView(msg.body), std::nullopt);
+        return;
+
+    case HeaderStatus::Server_GetPing: {
+        // clock sync, echoed right away so the round trip doesn't include the strand's backlog
+        hvr::clock::sPingPayload ping;
+        if (msg.body.size() != sizeof(ping))
+            return;
+
+        msg >> ping;
+        ping.nServerRecvUs = received;
+        ping.nServerSendUs = hvr::clock::NowMicros();
+        msg << ping;
+        conn->writer->Send(MakeSharedMessage(msg));
+        return;
+    }
+
+    case HeaderStatus::Server_GetStatus: {
+        msg.body.clear();
+        msg << GetStatus();
+        conn->writer->Send(MakeSharedMessage(msg));
+        return;
+    }
+
+    default:
+        break;
+    }
+
+    // the actual work happens on the connection's strand, in order, in parallel with other connections
+    asio::post(conn->strand, [this, conn, msg = std::move(msg)]() mutable {
+        ProcessMessage(*conn, msg);
+    });
+}
+
+void IpcServer::ProcessMessage(sIpcConnection& conn, olc::net::message<HeaderStatus>& msg)
+{
+    const auto& client = conn.connection;
+
     switch (msg.header.id) {
     case HeaderStatus::Client_RegisterWithServer: {
+        if (msg.body.size() < sizeof(sDeviceNetPacket))
+            break;
+
+        // options are optional, older clients just get everything
+        sRegisterOptions options;
+        sResumeToken resume;
+        const size_t extra = msg.body.size() - sizeof(sDeviceNetPacket);
+        if (extra >= sizeof(sRegisterOptions) + sizeof(sResumeToken))
+            msg >> resume;
+        if (extra >= sizeof(sRegisterOptions))
+            msg >> options;
+
         sDeviceNetPacket desc;
         msg >> desc;
         desc.nUniqueID = client->GetID();
-        m_mapPlayerRoster.insert_or_assign(desc.nUniqueID, desc);
+        {
+            std::unique_lock lock(m_roster_mutex);
+            m_mapPlayerRoster.insert_or_assign(desc.nUniqueID, desc);
+        }
+        bool connected = false;
+        {
+            std::unique_lock lock(m_clients_mutex);
+            const auto res = m_mapConnections.find(desc.nUniqueID);
+            if (res != m_mapConnections.end()) {
+                m_mapClients.insert_or_assign(desc.nUniqueID, sIpcClient { res->second, options.nSubscriptions });
+                connected = true;
+            }
+        }
+        if (!connected) {
+            // went away while we were getting here, the disconnect didn't know about the roster entry yet
+            std::unique_lock lock(m_roster_mutex);
+            m_mapPlayerRoster.erase(desc.nUniqueID);
+            break;
+        }
+        {
+            std::lock_guard lock(conn.mailbox_mutex);
+            conn.mailboxes.try_emplace(desc.nUniqueID);
+        }
+
+        // a client that doesn't bring its own token gets a fresh one
+        uint64_t token = 0;
+        if (m_settings.nResumeTimeoutMs > 0)
+            token = resume.nToken != 0 ? resume.nToken : NewResumeToken();
+        conn.nResumeToken = token;
 
         olc::net::message<HeaderStatus> msgSendID;
         msgSendID.header.id = HeaderStatus::Client_AssignID;
+        msgSendID << token;
         msgSendID << desc.nUniqueID;
-        MessageClient(client, msgSendID);
-        OnDeviceAdded(client, desc);
+        conn.writer->Send(MakeSharedMessage(msgSendID));
+        if (token == 0 || !ResumeSession(conn, token, desc))
+            OnDeviceAdded(desc);
 
+        // the new client always hears about its own device, that's how it knows it's in
         olc::net::message<HeaderStatus> msgAddPlayer;
         msgAddPlayer.header.id = HeaderStatus::Client_AddDevice;
         msgAddPlayer << desc;
-        MessageAllClients(msgAddPlayer);
+        const auto shared_add = MakeSharedMessage(msgAddPlayer);
+        MessageSubscribers(shared_add, Subscribe_DeviceAdd, client);
+        conn.writer->Send(shared_add);
 
+        if (!(options.nSubscriptions & Subscribe_DeviceAdd))
+            break;
+
+        std::shared_lock lock(m_roster_mutex);
         for (const auto& player : m_mapPlayerRoster) {
+            if (player.first == desc.nUniqueID)
+                continue;
+
             olc::net::message<HeaderStatus> msgAddOtherPlayers;
             msgAddOtherPlayers.header.id = HeaderStatus::Client_AddDevice;
             msgAddOtherPlayers << player.second;
-            MessageClient(client, msgAddOtherPlayers);
+            conn.writer->Send(MakeSharedMessage(msgAddOtherPlayers));
         }
 
         break;
     }
 
-    case HeaderStatus::Client_UpdateDevice: {
-        // Simply bounce update to everyone except incoming client
-        MessageAllClients(msg, client);
-        OnDeviceUpdate(client, msg);
+    case HeaderStatus::Client_RegisterSubDevice: {
+        // the main device has to be registered first
+        bool registered = false;
+        {
+            std::shared_lock lock(m_clients_mutex);
+            registered = m_mapClients.find(client->GetID()) != m_mapClients.end();
+        }
+        if (!registered || msg.body.size() < sizeof(sDeviceNetPacket))
+            break;
+
+        sDeviceNetPacket desc;
+        msg >> desc;
+        if (desc.nUniqueID == 0 || desc.nUniqueID >= k_nMaxSubDevices) {
+            DriverLog("Invalid sub device index %s", std::to_string(desc.nUniqueID).c_str());
+            break;
+        }
+
+        sSubDeviceID sub;
+        sub.nSubIndex = desc.nUniqueID;
+        sub.nUniqueID = MakeDeviceID(client->GetID(), sub.nSubIndex);
+        desc.nUniqueID = sub.nUniqueID;
+        bool existing = false;
+        {
+            std::unique_lock lock(m_roster_mutex);
+            existing = !m_mapPlayerRoster.emplace(desc.nUniqueID, desc).second;
+        }
+        {
+            std::lock_guard lock(conn.mailbox_mutex);
+            conn.mailboxes.try_emplace(desc.nUniqueID);
+        }
+
+        olc::net::message<HeaderStatus> msgSendID;
+        msgSendID.header.id = HeaderStatus::Client_AssignSubID;
+        msgSendID << sub;
+        conn.writer->Send(MakeSharedMessage(msgSendID));
+
+        // already there, most likely brought back by a session resume, it only needs to hear its id again
+        if (existing)
+            break;
+        OnDeviceAdded(desc);
+
+        olc::net::message<HeaderStatus> msgAddPlayer;
+        msgAddPlayer.header.id = HeaderStatus::Client_AddDevice;
+        msgAddPlayer << desc;
+        MessageSubscribers(MakeSharedMessage(msgAddPlayer), Subscribe_DeviceAdd);
+        break;
+    }
+
+    case HeaderStatus::Client_UpdateDeviceBatch: {
+        OnDeviceBatch(conn, hvr::net::ByteView(msg.body));
+        break;
+    }
+
+    case HeaderStatus::Client_RequestSharedMemory: {
+        // only registered clients get a channel
+        bool registered = false;
+        {
+            std::shared_lock lock(m_clients_mutex);
+            registered = m_mapClients.find(client->GetID()) != m_mapClients.end();
+        }
+        if (!registered)
+            break;
+
+        auto channel = std::make_shared<sShmChannel>();
+        if (!channel->shm.Create(ShmChannelName(m_settings.nPort, client->GetID()))) {
+            DriverLog("Failed to create shared memory channel for %s", std::to_string(client->GetID()).c_str());
+            break;
+        }
+        {
+            std::lock_guard lock(m_shm_mutex);
+            m_mapShmChannels.insert_or_assign(client->GetID(), std::move(channel));
+        }
+
+        olc::net::message<HeaderStatus> msgReady;
+        msgReady.header.id = HeaderStatus::Client_SharedMemoryReady;
+        conn.writer->Send(MakeSharedMessage(msgReady));
         break;
     }
     default:
@@ -92,89 +458,853 @@ void IpcServer::OnMessage(std::shared_ptr<olc::net::connection<HeaderStatus>> cl
     }
 }
 
-void IpcServer::OnDeviceAdded(std::shared_ptr<olc::net::connection<HeaderStatus>> client, const sDeviceNetPacket& desc)
+void IpcServer::OnDeviceAdded(const sDeviceNetPacket& desc)
 {
+    // ignore client if its device type is not supported
+    if (std::find(
+            m_supported_device_types.begin(),
+            m_supported_device_types.end(),
+            desc.eDeviceType)
+            == m_supported_device_types.end()
+        || desc.eDeviceType == DeviceType::Invalid) {
+        DriverLog("REQUESTED DEVICE TYPE NOT SUPPORTED!!!");
+        return;
+    }
+
+    // an already activated device of the same kind, if there is one
     std::unique_ptr<IHvrTrackedDevice> tracker_device;
-    if (m_deactivated_devices.empty()) {
-        // ignore client if its device type is not supported
-        if (std::find(
-                m_supported_device_types.begin(),
-                m_supported_device_types.end(),
-                desc.eDeviceType)
-                == m_supported_device_types.end()
-            || desc.eDeviceType == DeviceType::Invalid) {
-            DriverLog("REQUESTED DEVICE TYPE NOT SUPPORTED!!!");
+    {
+        std::unique_lock lock(m_devices_mutex);
+        const auto res = m_mapDevicePool.find(PoolKey(desc.eDeviceType, desc.eDeviceRole));
+        if (res != m_mapDevicePool.end() && !res->second.empty()) {
+            tracker_device = std::move(res->second.back());
+            res->second.pop_back();
+        }
+    }
+
+    if (tracker_device) {
+        tracker_device->hTurnOn();
+    } else {
+        tracker_device = CreateDevice(desc.nUniqueID, desc.eDeviceType, desc.eDeviceRole);
+        if (!AddToVrServer(*tracker_device))
             return;
+    }
+
+    std::unique_lock lock(m_devices_mutex);
+    my_tracker_devices.emplace(desc.nUniqueID, std::move(tracker_device));
+    m_bEventIndexDirty = true;
+}
+
+std::unique_ptr<IHvrTrackedDevice> IpcServer::CreateDevice(const uint32_t serial_id, const DeviceType type, const DeviceRole role)
+{
+    std::unique_ptr<IHvrTrackedDevice> tracker_device;
+    switch (type) {
+    case DeviceType::ControllerViveLike:
+        DriverLog("Adding controller device");
+        tracker_device = std::make_unique<MyControllerDeviceDriver>(serial_id, role);
+        break;
+    case DeviceType::ControllerIndexLike:
+        DriverLog("Adding index controller device");
+        tracker_device = std::make_unique<MyControllerDeviceDriver>(serial_id, role, type);
+        break;
+    case DeviceType::Tracker:
+    default: // tracker is the default type
+        DriverLog("Adding tracker device");
+        tracker_device = std::make_unique<MyTrackerDeviceDriver>(serial_id);
+        break;
+    }
+    tracker_device->hSetPoseSettings(m_settings.PoseSettingsFor(tracker_device->hGetDeviceType(), tracker_device->hGetDeviceRole()));
+    return tracker_device;
+}
+
+bool IpcServer::AddToVrServer(IHvrTrackedDevice& device)
+{
+    // Now we need to tell vrserver about our controllers.
+    // The first argument is the serial number of the device, which must be unique across all devices.
+    // We get it from our driver settings when we instantiate,
+    // And can pass it out of the function with MyGetSerialNumber().
+    // make sure we actually managed to create the device.
+    // TrackedDeviceAdded returning true means we have had our device added to SteamVR.
+    if (!vr::VRServerDriverHost()->TrackedDeviceAdded(
+            device.hGetSerialNumber().c_str(),
+            toVr(device.hGetDeviceType()),
+            &device)) {
+        DriverLog("Failed to create device!");
+        return false;
+    }
+    return true;
+}
+
+void IpcServer::ProvisionDevices()
+{
+    const std::array<std::pair<DeviceType, DeviceRole>, 3> kinds = { {
+        { DeviceType::Tracker, DeviceRole::Neither },
+        { DeviceType::ControllerViveLike, DeviceRole::Left },
+        { DeviceType::ControllerViveLike, DeviceRole::Right },
+    } };
+
+    for (const auto& [type, role] : kinds) {
+        const int32_t count = type == DeviceType::Tracker ? m_settings.nWarmTrackers : m_settings.nWarmControllers;
+        for (int32_t i = 0; i < count; i++) {
+            // connection 0 is never handed out, warm devices take their serials from there
+            if (m_nNextWarmSerial >= k_nMaxSubDevices) {
+                DriverLog("Warm pool is full");
+                return;
+            }
+            auto device = CreateDevice(MakeDeviceID(0, m_nNextWarmSerial++), type, role);
+
+            // turned off before vrserver activates it, so it comes up disconnected
+            device->hTurnOff();
+            if (!AddToVrServer(*device))
+                continue;
+
+            std::unique_lock lock(m_devices_mutex);
+            m_mapDevicePool[PoolKey(type, role)].push_back(std::move(device));
         }
+    }
+}
 
-        switch (desc.eDeviceType) {
-        case DeviceType::ControllerViveLike:
-            DriverLog("Adding controller device");
-            tracker_device = std::make_unique<MyControllerDeviceDriver>(client->GetID(), desc.eDeviceRole);
-            break;
-        case DeviceType::Tracker:
-        default: // tracker is the default type
-            DriverLog("Adding tracker device");
-            tracker_device = std::make_unique<MyTrackerDeviceDriver>(client->GetID());
-            break;
+bool IpcServer::ResumeSession(sIpcConnection& conn, const uint64_t token, const sDeviceNetPacket& desc)
+{
+    std::optional<sSuspendedSession> session;
+    {
+        std::lock_guard lock(m_sessions_mutex);
+        auto res = m_mapSuspendedSessions.extract(token);
+        if (!res)
+            return false;
+        session = std::move(res.mapped());
+    }
+
+    // the main device has to come back as the same thing, otherwise start over
+    const auto main = session->devices.find(0);
+    if (main == session->devices.end() || PoolKey(main->second.desc.eDeviceType, main->second.desc.eDeviceRole) != PoolKey(desc.eDeviceType, desc.eDeviceRole)) {
+        for (auto& [sub, suspended] : session->devices) {
+            ParkDevice(std::move(suspended.device));
+        }
+        return false;
+    }
+
+    const uint32_t cid = conn.connection->GetID();
+    for (auto& [sub, suspended] : session->devices) {
+        const uint32_t pid = MakeDeviceID(cid, sub);
+        DriverLog("[RESUMED]: %s as %s", std::to_string(suspended.desc.nUniqueID).c_str(), std::to_string(pid).c_str());
+
+        // the main device's roster entry is the fresh one from the registration,
+        // sub devices pick up where they left off
+        if (sub != 0) {
+            suspended.desc.nUniqueID = pid;
+            {
+                std::unique_lock lock(m_roster_mutex);
+                m_mapPlayerRoster.insert_or_assign(pid, suspended.desc);
+            }
+            {
+                std::lock_guard lock(conn.mailbox_mutex);
+                conn.mailboxes.try_emplace(pid);
+            }
+
+            olc::net::message<HeaderStatus> msgAddPlayer;
+            msgAddPlayer.header.id = HeaderStatus::Client_AddDevice;
+            msgAddPlayer << suspended.desc;
+            MessageSubscribers(MakeSharedMessage(msgAddPlayer), Subscribe_DeviceAdd, conn.connection);
         }
 
-        // Now we need to tell vrserver about our controllers.
-        // The first argument is the serial number of the device, which must be unique across all devices.
-        // We get it from our driver settings when we instantiate,
-        // And can pass it out of the function with MyGetSerialNumber().
-        // Let's add the left hand controller first (there isn't a specific order).
-        // make sure we actually managed to create the device.
-        // TrackedDeviceAdded returning true means we have had our device added to SteamVR.
-        if (!vr::VRServerDriverHost()->TrackedDeviceAdded(
-                tracker_device->hGetSerialNumber().c_str(),
-                toVr(desc.eDeviceType),
-                tracker_device.get())) {
-            DriverLog("Failed to create device!");
-            // We failed? Return early.
+        if (!suspended.device)
+            continue;
+
+        std::unique_lock lock(m_devices_mutex);
+        suspended.device->hTurnOn();
+        my_tracker_devices.insert_or_assign(pid, std::move(suspended.device));
+        m_bEventIndexDirty = true;
+    }
+    return true;
+}
+
+void IpcServer::ExpireSessions()
+{
+    std::vector<sSuspendedSession> expired;
+    {
+        std::lock_guard lock(m_sessions_mutex);
+        if (m_mapSuspendedSessions.empty())
             return;
+
+        const auto now = std::chrono::steady_clock::now();
+        for (auto it = m_mapSuspendedSessions.begin(); it != m_mapSuspendedSessions.end();) {
+            if (it->second.expires <= now) {
+                expired.push_back(std::move(it->second));
+                it = m_mapSuspendedSessions.erase(it);
+            } else {
+                ++it;
+            }
         }
-    } else {
-        tracker_device = std::move(m_deactivated_devices.back());
-        tracker_device->hTurnOn();
-        m_deactivated_devices.pop_back();
     }
 
-    my_tracker_devices.emplace(client->GetID(), std::move(tracker_device));
+    for (auto& session : expired) {
+        for (auto& [sub, suspended] : session.devices) {
+            DriverLog("[UNGRACEFUL REMOVAL]: %s", std::to_string(suspended.desc.nUniqueID).c_str());
+            ParkDevice(std::move(suspended.device));
+        }
+    }
 }
 
-void IpcServer::OnDeviceUpdate(std::shared_ptr<olc::net::connection<HeaderStatus>> client, olc::net::message<HeaderStatus>& msg)
+void IpcServer::EnqueueDeviceUpdate(const std::shared_ptr<sIpcConnection>& conn, const uint32_t pid, HeaderStatus id, hvr::net::ByteView body, const std::optional<uint32_t> sequence)
 {
-    const auto res = my_tracker_devices.find(client->GetID());
-    if (res != my_tracker_devices.end()) {
-        res->second->hProcessMsg(msg);
-    } else {
-        DriverLog("DEVICE %s MISSING!!!", std::to_string(client->GetID()).c_str());
+    if (sequence) {
+        std::lock_guard lock(conn->mailbox_mutex);
+        const auto res = conn->mailboxes.find(pid);
+        if (res == conn->mailboxes.end())
+            return;
+
+        auto& mailbox = res->second;
+        if (mailbox.bHasSequence && !SequenceNewer(*sequence, mailbox.nLastSequence)) {
+            m_nStaleUpdates++;
+            return;
+        }
+        mailbox.bHasSequence = true;
+        mailbox.nLastSequence = *sequence;
+    }
+
+    sDeviceNetPacket full_packet;
+    switch (id) {
+    case HeaderStatus::Client_UpdateDeviceDelta: {
+        // rebuild the full packet from the last known state, deltas have to be applied in order
+        // so this can't wait for the mailbox, everything after here only ever sees full updates
+        {
+            std::unique_lock lock(m_roster_mutex);
+            const auto res = m_mapPlayerRoster.find(pid);
+            if (res == m_mapPlayerRoster.end() || !hvr::delta::ApplyDeltaUpdate(body, res->second)) {
+                DriverLog("Dropping malformed delta from %s", std::to_string(pid).c_str());
+                return;
+            }
+            res->second.nUniqueID = pid;
+            full_packet = res->second;
+        }
+
+        id = HeaderStatus::Client_UpdateDevice;
+        body = hvr::net::ByteView(reinterpret_cast<const uint8_t*>(&full_packet), sizeof(full_packet));
+        break;
+    }
+
+    case HeaderStatus::Client_UpdateDevice: {
+        const auto packet = body.Tail(sizeof(sDeviceNetPacket));
+        if (!packet.empty())
+            StoreKeyframe(pid, packet.data());
+        break;
+    }
+
+    case HeaderStatus::Client_UpdateDeviceCompact: {
+        // snapshots are built from the roster, so it has to follow compact updates too
+        if (m_settings.nSnapshotRateHz > 0) {
+            std::unique_lock lock(m_roster_mutex);
+            const auto res = m_mapPlayerRoster.find(pid);
+            if (res != m_mapPlayerRoster.end())
+                ReadCompactUpdate(body, res->second);
+        }
+        break;
+    }
+
+    default:
+        return;
+    }
+
+    {
+        std::lock_guard lock(conn->mailbox_mutex);
+        const auto res = conn->mailboxes.find(pid);
+        if (res == conn->mailboxes.end() || body.size() > res->second.slot.aBody.size())
+            return;
+
+        auto& mailbox = res->second;
+        if (mailbox.bFull) {
+            m_nCoalescedUpdates++;
+
+            // the pose can go, a button that was pressed in it can't
+            const DevicePacketView replaced(hvr::net::ByteView(mailbox.slot.aBody.data(), mailbox.slot.nSize).Tail(sizeof(sDeviceNetPacket)));
+            if (mailbox.slot.eHeader == HeaderStatus::Client_UpdateDevice && replaced.Valid()) {
+                const auto bools = static_cast<uint16_t>(replaced.BoolStates().to_ulong());
+                mailbox.skipped.nDown |= bools;
+                mailbox.skipped.nUp |= static_cast<uint16_t>(~bools);
+            }
+        }
+
+        mailbox.slot.eHeader = id;
+        mailbox.slot.nSize = static_cast<uint32_t>(body.size());
+        std::memcpy(mailbox.slot.aBody.data(), body.data(), body.size());
+        mailbox.bFull = true;
+    }
+
+    // one drain per connection in flight, it picks up whatever landed in the mailboxes until it runs
+    if (!conn->bDrainScheduled.exchange(true)) {
+        asio::post(conn->strand, [this, conn]() {
+            DrainMailboxes(*conn);
+        });
+    }
+}
+
+void IpcServer::DrainMailboxes(sIpcConnection& conn)
+{
+    // cleared first, anything that comes in while we're busy schedules the next drain
+    conn.bDrainScheduled = false;
+
+    conn.vDrained.clear();
+    {
+        std::lock_guard lock(conn.mailbox_mutex);
+        for (auto& [pid, mailbox] : conn.mailboxes) {
+            if (!mailbox.bFull)
+                continue;
+
+            mailbox.bFull = false;
+            // only full updates carry buttons, anything else leaves the skipped ones for the next of those
+            if (mailbox.slot.eHeader != HeaderStatus::Client_UpdateDevice) {
+                conn.vDrained.push_back({ pid, mailbox.slot, {} });
+                continue;
+            }
+            conn.vDrained.push_back({ pid, mailbox.slot, mailbox.skipped });
+            mailbox.skipped = {};
+        }
+    }
+
+    for (const auto& drained : conn.vDrained) {
+        const auto& slot = drained.slot;
+        HandleDeviceUpdate(drained.nUniqueID, conn, slot.eHeader, hvr::net::ByteView(slot.aBody.data(), slot.nSize), drained.skipped);
+    }
+}
+
+void IpcServer::HandleDeviceUpdate(const uint32_t pid, sIpcConnection& conn, const HeaderStatus id, const hvr::net::ByteView body, const sSkippedButtons& skipped)
+{
+    // Simply bounce update to everyone except incoming client
+    BounceDeviceUpdate(pid, conn, id, body);
+    OnDeviceUpdate(pid, id, body, skipped);
+}
+
+void IpcServer::MessageSubscribers(const SharedMessage& msg, const SubscribeFlags flag, std::shared_ptr<olc::net::connection<HeaderStatus>> pIgnoreClient)
+{
+    std::vector<std::shared_ptr<olc::net::connection<HeaderStatus>>> disconnected;
+
+    {
+        std::shared_lock lock(m_clients_mutex);
+        for (const auto& [cid, info] : m_mapClients) {
+            const auto& connection = info.state->connection;
+            // dead is dead, whatever it subscribed to
+            if (!info.state->writer->IsConnected()) {
+                disconnected.push_back(connection);
+                continue;
+            }
+            if (connection == pIgnoreClient || !(info.nSubscriptions & flag))
+                continue;
+
+            info.state->writer->Send(msg);
+        }
+    }
+    DropConnections(disconnected);
+}
+
+void IpcServer::ReapConnections()
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (now < m_next_reap)
+        return;
+    m_next_reap = now + std::chrono::milliseconds(100);
+
+    // Producers that subscribe to nothing never get written to, so fan-out never notices them going away.
+    // The probes land on olc's thread, whatever they found shows up on the next sweep
+    std::vector<std::shared_ptr<olc::net::connection<HeaderStatus>>> disconnected;
+    {
+        std::shared_lock lock(m_clients_mutex);
+        for (const auto& [cid, conn] : m_mapConnections) {
+            if (conn->writer->IsConnected())
+                conn->writer->Probe();
+            else
+                disconnected.push_back(conn->connection);
+        }
+    }
+    DropConnections(disconnected);
+}
+
+void IpcServer::DropConnections(std::vector<std::shared_ptr<olc::net::connection<HeaderStatus>>>& disconnected)
+{
+    if (disconnected.empty())
+        return;
+
+    // MessageClient's cleanup for dead connections. Only whoever takes one out of m_deqConnections
+    // gets to call OnClientDisconnect for it, after the lock is gone, it takes the other locks
+    {
+        std::lock_guard lock(m_connections_mutex);
+        disconnected.erase(std::remove_if(disconnected.begin(), disconnected.end(), [this](const auto& client) {
+            const auto res = std::find(m_deqConnections.begin(), m_deqConnections.end(), client);
+            if (res == m_deqConnections.end())
+                return true;
+            m_deqConnections.erase(res);
+            return false;
+        }),
+            disconnected.end());
+    }
+    for (auto& client : disconnected) {
+        OnClientDisconnect(client);
     }
 }
 
+bool IpcServer::StoreKeyframe(const uint32_t pid, const uint8_t* packet)
+{
+    // full updates double as keyframes for the delta chain
+    std::unique_lock lock(m_roster_mutex);
+    const auto res = m_mapPlayerRoster.find(pid);
+    if (res == m_mapPlayerRoster.end())
+        return false;
+
+    std::memcpy(&res->second, packet, sizeof(sDeviceNetPacket));
+    res->second.nUniqueID = pid;
+    return true;
+}
+
+void IpcServer::OnDeviceBatch(sIpcConnection& conn, const hvr::net::ByteView body)
+{
+    const auto& client = conn.connection;
+
+    uint32_t count = 0;
+    if (!body.Tail(sizeof(count)).Read(0, count))
+        return;
+
+    const auto packets = body.DropTail(sizeof(count));
+    if (packets.size() != static_cast<size_t>(count) * sizeof(sDeviceNetPacket)) {
+        DriverLog("Dropping malformed batch from %s", std::to_string(client->GetID()).c_str());
+        return;
+    }
+
+    const bool bounce = m_settings.nSnapshotRateHz <= 0;
+    std::shared_ptr<sSharedMessage> shared;
+    if (bounce) {
+        shared = conn.pool.Acquire();
+        shared->header.id = HeaderStatus::Client_UpdateDeviceBatch;
+    }
+
+    uint32_t accepted = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const auto packet = packets.Slice(i * sizeof(sDeviceNetPacket), sizeof(sDeviceNetPacket));
+        const uint32_t pid = DevicePacketView(packet).UniqueID();
+
+        // a connection can only update its own devices
+        if (ConnectionOf(pid) != client->GetID() || !StoreKeyframe(pid, packet.data()))
+            continue;
+
+        OnDeviceUpdate(pid, HeaderStatus::Client_UpdateDevice, packet);
+
+        // only what we took goes out again, the rest never happened as far as everyone else is concerned
+        if (bounce)
+            shared->body.insert(shared->body.end(), packet.data(), packet.data() + packet.size());
+        accepted++;
+    }
+
+    if (!bounce) {
+        m_snapshot_dirty = true;
+        return;
+    }
+    if (accepted == 0)
+        return;
+
+    // everyone else gets the batch as a whole, with the count of what's actually in it
+    const auto* count_bytes = reinterpret_cast<const uint8_t*>(&accepted);
+    shared->body.insert(shared->body.end(), count_bytes, count_bytes + sizeof(accepted));
+    shared->header.size = static_cast<uint32_t>(shared->body.size());
+    shared->nReplaceKey = MakeReplaceKey(HeaderStatus::Client_UpdateDeviceBatch, client->GetID());
+    MessageSubscribers(shared, Subscribe_DeviceUpdate, client);
+}
+
+void IpcServer::BounceDeviceUpdate(const uint32_t pid, sIpcConnection& conn, const HeaderStatus id, const hvr::net::ByteView body)
+{
+    // the next snapshot picks it up from the roster
+    if (m_settings.nSnapshotRateHz > 0) {
+        m_snapshot_dirty = true;
+        return;
+    }
+
+    // the only copy of the update on its way through, every subscriber writes out the same buffer
+    auto msg = conn.pool.Acquire();
+    msg->header.id = id;
+    msg->body.assign(body.data(), body.data() + body.size());
+    msg->nReplaceKey = MakeReplaceKey(id, pid);
+
+    // compact updates don't carry the sender id, so tag them for everyone else
+    if (id == HeaderStatus::Client_UpdateDeviceCompact) {
+        const auto* tag = reinterpret_cast<const uint8_t*>(&pid);
+        msg->body.insert(msg->body.end(), tag, tag + sizeof(pid));
+    }
+    msg->header.size = static_cast<uint32_t>(msg->body.size());
+
+    MessageSubscribers(msg, Subscribe_DeviceUpdate, conn.connection);
+}
+
+void IpcServer::OnDeviceUpdate(const uint32_t pid, const HeaderStatus id, const hvr::net::ByteView body, const sSkippedButtons& skipped)
+{
+    {
+        // shared, devices of different connections update in parallel
+        std::shared_lock lock(m_devices_mutex);
+        const auto res = my_tracker_devices.find(pid);
+        if (res == my_tracker_devices.end()) {
+            DriverLog("DEVICE %s MISSING!!!", std::to_string(pid).c_str());
+            return;
+        }
+        res->second->hProcessMsg(id, body, skipped);
+    }
+    NotifyPublisher();
+}
+
+void IpcServer::NotifyPublisher()
+{
+    if (m_settings.FixedPublishRateHz() > 0 || m_bPublishPending.exchange(true))
+        return;
+
+    std::lock_guard lock(m_publish_mutex);
+    m_publish_cv.notify_one();
+}
+
+void IpcServer::PublishPoses()
+{
+    // On notification there's still a pass every now and then, turning devices on and off doesn't notify.
+    // With prediction on it's every tick, a device that stopped sending is what prediction is there for
+    const int32_t fixed_rate = m_settings.FixedPublishRateHz();
+    auto interval = std::chrono::microseconds(100000);
+    if (fixed_rate > 0)
+        interval = std::chrono::microseconds(1000000 / fixed_rate);
+    else if (m_settings.Predicts() && m_settings.nPublishTickHz > 0)
+        interval = std::chrono::microseconds(1000000 / m_settings.nPublishTickHz);
+    auto next = std::chrono::steady_clock::now();
+
+    while (m_bPublishing) {
+        if (fixed_rate > 0) {
+            // don't try to catch up on missed ticks
+            next = std::max(next + interval, std::chrono::steady_clock::now());
+            std::this_thread::sleep_until(next);
+        } else {
+            std::unique_lock lock(m_publish_mutex);
+            m_publish_cv.wait_for(lock, interval, [this]() { return m_bPublishPending || !m_bPublishing; });
+        }
+        m_bPublishPending = false;
+
+        {
+            std::shared_lock lock(m_devices_mutex);
+            for (const auto& [pid, device] : my_tracker_devices) {
+                if (device)
+                    device->hPublish();
+            }
+            // pooled devices still need to show up as disconnected
+            for (const auto& [key, pool] : m_mapDevicePool) {
+                for (const auto& device : pool) {
+                    device->hPublish();
+                }
+            }
+        }
+
+        std::lock_guard lock(m_sessions_mutex);
+        for (const auto& [token, session] : m_mapSuspendedSessions) {
+            for (const auto& [sub, suspended] : session.devices) {
+                if (suspended.device)
+                    suspended.device->hPublish();
+            }
+        }
+    }
+}
+
+void IpcServer::PollSharedMemory()
+{
+    // channels with something in them, looked up after the lock is gone
+    std::vector<std::pair<uint32_t, std::shared_ptr<sShmChannel>>> pending;
+    {
+        std::lock_guard lock(m_shm_mutex);
+        for (auto pid : m_vClosedShmChannels) {
+            m_mapShmChannels.erase(pid);
+        }
+        m_vClosedShmChannels.clear();
+
+        for (const auto& [pid, channel] : m_mapShmChannels) {
+            if (channel->shm->ring.Count() != 0 && !channel->bDraining.exchange(true))
+                pending.emplace_back(pid, channel);
+        }
+    }
+
+    for (auto& [pid, channel] : pending) {
+        std::shared_ptr<sIpcConnection> conn;
+        {
+            std::shared_lock lock(m_clients_mutex);
+            const auto res = m_mapConnections.find(pid);
+            if (res != m_mapConnections.end())
+                conn = res->second;
+        }
+        if (!conn) {
+            channel->bDraining = false;
+            continue;
+        }
+
+        // the ring stays in order with the tcp messages of the same connection
+        asio::post(conn->strand, [this, conn, pid = pid, channel = std::move(channel)]() {
+            DrainSharedMemory(conn, pid, *channel);
+        });
+    }
+}
+
+void IpcServer::DrainSharedMemory(const std::shared_ptr<sIpcConnection>& conn, const uint32_t pid, sShmChannel& channel)
+{
+    auto& ring = channel.shm->ring;
+    while (const auto* slot = ring.Front()) {
+        m_nMessagesIn++;
+        if (slot->nSize <= slot->aBody.size()) {
+            // read straight out of the slot, it's only handed back to the client on Pop
+            const hvr::net::ByteView body(slot->aBody.data(), slot->nSize);
+
+            // the ring is ordered, so deltas are fine in here
+            const bool is_update = IsDeviceUpdate(slot->eHeader) || slot->eHeader == HeaderStatus::Client_UpdateDeviceDelta;
+            if (slot->eHeader == HeaderStatus::Client_UpdateDeviceBatch) {
+                OnDeviceBatch(*conn, body);
+            } else if (is_update && ConnectionOf(slot->nUniqueID) == pid) {
+                // any device of the connection that owns the ring, sub devices included
+                EnqueueDeviceUpdate(conn, slot->nUniqueID, slot->eHeader, body, std::nullopt);
+            }
+        }
+        ring.Pop();
+    }
+    channel.bDraining = false;
+}
+
+void IpcServer::BroadcastSnapshot()
+{
+    // nothing to send doesn't leave dead snapshot clients hanging, ReapConnections() takes care of those
+    if (m_settings.nSnapshotRateHz <= 0 || !m_snapshot_dirty)
+        return;
+
+    const auto now = std::chrono::steady_clock::now();
+    if (now < m_next_snapshot)
+        return;
+
+    // don't try to catch up on missed ticks, just keep the rate from here
+    m_next_snapshot = std::max(m_next_snapshot + std::chrono::microseconds(1000000 / m_settings.nSnapshotRateHz), now);
+    m_snapshot_dirty = false;
+
+    // a newer snapshot has everything an older one has
+    auto msg = m_snapshot_pool.Acquire();
+    msg->header.id = HeaderStatus::Client_Snapshot;
+    msg->nReplaceKey = MakeReplaceKey(HeaderStatus::Client_Snapshot, 0);
+    {
+        std::shared_lock lock(m_roster_mutex);
+        msg->body.reserve(m_mapPlayerRoster.size() * sizeof(sDeviceNetPacket) + sizeof(uint32_t));
+        for (const auto& player : m_mapPlayerRoster) {
+            const auto* bytes = reinterpret_cast<const uint8_t*>(&player.second);
+            msg->body.insert(msg->body.end(), bytes, bytes + sizeof(sDeviceNetPacket));
+        }
+    }
+    const auto count = static_cast<uint32_t>(msg->body.size() / sizeof(sDeviceNetPacket));
+    const auto* count_bytes = reinterpret_cast<const uint8_t*>(&count);
+    msg->body.insert(msg->body.end(), count_bytes, count_bytes + sizeof(count));
+    msg->header.size = static_cast<uint32_t>(msg->body.size());
+
+    MessageSubscribers(msg, Subscribe_Snapshot);
+}
+
+void IpcServer::ReportCounters()
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= m_next_rate_sample) {
+        const uint64_t messages = m_nMessagesIn;
+        const auto elapsed = std::chrono::duration<double>(now - m_next_rate_sample + std::chrono::seconds(1)).count();
+        m_nMessagesPerSecond = static_cast<uint32_t>((messages - m_nLastMessagesIn) / elapsed);
+        m_nLastMessagesIn = messages;
+        m_next_rate_sample = now + std::chrono::seconds(1);
+    }
+
+    if (now < m_next_report)
+        return;
+    m_next_report = now + std::chrono::seconds(10);
+
+    const uint64_t coalesced = m_nCoalescedUpdates;
+    const uint64_t stale = m_nStaleUpdates;
+    const uint64_t dropped = DroppedOutgoing();
+    if (coalesced == m_nReportedCoalesced && stale == m_nReportedStale && dropped == m_nReportedDropped)
+        return;
+
+    DriverLog("Skipped %s coalesced updates and %s stale datagrams, dropped %s outgoing updates in the last 10s",
+        std::to_string(coalesced - m_nReportedCoalesced).c_str(),
+        std::to_string(stale - m_nReportedStale).c_str(),
+        std::to_string(dropped - m_nReportedDropped).c_str());
+    m_nReportedCoalesced = coalesced;
+    m_nReportedStale = stale;
+    m_nReportedDropped = dropped;
+}
+
+sServerStatus IpcServer::GetStatus()
+{
+    sServerStatus status;
+    status.nMessagesPerSecond = m_nMessagesPerSecond;
+    status.nIncomingQueueDepth = static_cast<uint32_t>(m_qMessagesIn.count());
+    status.nCoalescedUpdates = static_cast<uint32_t>(m_nCoalescedUpdates);
+    status.nDroppedOutgoing = static_cast<uint32_t>(DroppedOutgoing());
+    {
+        std::shared_lock lock(m_clients_mutex);
+        status.nConnectedClients = static_cast<uint32_t>(m_mapConnections.size());
+        status.nRegisteredClients = static_cast<uint32_t>(m_mapClients.size());
+        for (const auto& [cid, conn] : m_mapConnections) {
+            status.nOutgoingQueueDepth += static_cast<uint32_t>(conn->writer->QueueDepth());
+        }
+    }
+    {
+        std::shared_lock lock(m_devices_mutex);
+        status.nActiveDevices = static_cast<uint32_t>(my_tracker_devices.size());
+        for (const auto& [key, pool] : m_mapDevicePool) {
+            status.nDeactivatedDevices += static_cast<uint32_t>(pool.size());
+        }
+    }
+    status.nServerTimeUs = hvr::clock::NowMicros();
+    return status;
+}
+
+uint64_t IpcServer::DroppedOutgoing()
+{
+    uint64_t dropped = m_nDroppedOutgoing;
+
+    std::shared_lock lock(m_clients_mutex);
+    for (const auto& [cid, conn] : m_mapConnections) {
+        dropped += conn->writer->Dropped();
+    }
+    return dropped;
+}
+
+void IpcServer::ReceiveDatagram()
+{
+    m_udp_socket.async_receive_from(asio::buffer(m_udp_buffer), m_udp_remote,
+        [this](std::error_code ec, std::size_t length) {
+            // socket got closed, we're shutting down
+            if (!m_udp_socket.is_open())
+                return;
+
+            if (!ec && length >= sizeof(sDatagramHeader)) {
+                sDatagramHeader header;
+                std::memcpy(&header, m_udp_buffer.data(), sizeof(header));
+
+                // registration and friends have to go over tcp, drop anything else
+                const size_t size = length - sizeof(header);
+                if (IsDeviceUpdate(header.header.id) && header.header.size == size) {
+                    // only ids handed out in Client_AssignID or Client_AssignSubID are allowed to use the fast path,
+                    // those are the ones with a mailbox
+                    std::shared_ptr<sIpcConnection> conn;
+                    {
+                        std::shared_lock lock(m_clients_mutex);
+                        const auto res = m_mapClients.find(ConnectionOf(header.nUniqueID));
+                        // and only from the host that registered them, anyone can put a known id in a datagram
+                        if (res != m_mapClients.end() && res->second.state->peer == m_udp_remote.address())
+                            conn = res->second.state;
+                    }
+
+                    // same as the tcp path, the mailbox copies it out of our receive buffer
+                    if (conn) {
+                        m_nMessagesIn++;
+                        const hvr::net::ByteView body(m_udp_buffer.data() + sizeof(header), size);
+                        EnqueueDeviceUpdate(conn, header.nUniqueID, header.header.id, body, header.nSequence);
+                    }
+                }
+            }
+
+            ReceiveDatagram();
+        });
+}
+
 void IpcServer::OnDeviceRemove(const uint32_t pid)
 {
+    ParkDevice(DetachDevice(pid));
+}
+
+std::unique_ptr<IHvrTrackedDevice> IpcServer::DetachDevice(const uint32_t pid)
+{
+    std::unique_lock lock(m_devices_mutex);
     const auto res = my_tracker_devices.find(pid);
     if (res == my_tracker_devices.end())
-        return;
+        return nullptr;
 
-    res->second->hTurnOff();
-
-    m_deactivated_devices.emplace_back(std::move(res->second));
+    auto device = std::move(res->second);
     my_tracker_devices.erase(res);
+    m_bEventIndexDirty = true;
+    if (device)
+        device->hTurnOff();
+    return device;
+}
+
+void IpcServer::ParkDevice(std::unique_ptr<IHvrTrackedDevice> device)
+{
+    if (!device)
+        return;
+
+    const auto key = PoolKey(device->hGetDeviceType(), device->hGetDeviceRole());
+    std::unique_lock lock(m_devices_mutex);
+    m_mapDevicePool[key].push_back(std::move(device));
 }
 
 void IpcServer::OnVRevent(const vr::VREvent_t& event)
 {
-    for (const auto& devices : my_tracker_devices) {
-        devices.second->hProcessEvent(event);
+    // a device that just activated has its index and components now
+    if (event.eventType == vr::VREvent_TrackedDeviceActivated)
+        m_bEventIndexDirty = true;
+
+    std::shared_lock lock(m_devices_mutex);
+    // devices only go away under the exclusive lock, which sets the flag, so nothing in the index is dangling
+    if (m_bEventIndexDirty.exchange(false))
+        RebuildEventIndex();
+
+    m_event_index.Dispatch(event, m_vPendingHaptics);
+}
+
+void IpcServer::RebuildEventIndex()
+{
+    m_event_index.Clear();
+    for (const auto& [pid, device] : my_tracker_devices) {
+        if (!device)
+            continue;
+
+        m_vInterests.clear();
+        device->hGetEventInterests(m_vInterests);
+        for (const auto& interest : m_vInterests) {
+            m_event_index.Add(pid, device.get(), interest);
+        }
+    }
+}
+
+void IpcServer::FlushHaptics()
+{
+    if (m_vPendingHaptics.empty())
+        return;
+
+    // only the devices that got a pulse this frame, a device with several of them is on here more than once
+    m_vHaptics.clear();
+    {
+        std::shared_lock lock(m_devices_mutex);
+        for (const auto pid : m_vPendingHaptics) {
+            const auto res = my_tracker_devices.find(pid);
+            sHapticPulse pulse;
+            if (res != my_tracker_devices.end() && res->second && res->second->hTakeHaptic(pulse)) {
+                pulse.nUniqueID = pid;
+                m_vHaptics.push_back(pulse);
+            }
+        }
+    }
+    m_vPendingHaptics.clear();
+
+    std::shared_lock lock(m_clients_mutex);
+    for (const auto& pulse : m_vHaptics) {
+        const auto res = m_mapClients.find(ConnectionOf(pulse.nUniqueID));
+        if (res == m_mapClients.end())
+            continue;
+
+        // a client that fell behind only gets the newest pulse per device
+        auto msg = m_haptic_pool.Acquire();
+        msg->header.id = HeaderStatus::Client_Haptic;
+        msg->nReplaceKey = MakeReplaceKey(HeaderStatus::Client_Haptic, pulse.nUniqueID);
+        const auto* bytes = reinterpret_cast<const uint8_t*>(&pulse);
+        msg->body.assign(bytes, bytes + sizeof(pulse));
+        msg->header.size = static_cast<uint32_t>(msg->body.size());
+
+        res->second.state->writer->Send(msg);
     }
 }
 
 void IpcServer::StopAllDevices()
 {
+    std::unique_lock lock(m_devices_mutex);
     for (auto& tracker : my_tracker_devices) {
         tracker.second = nullptr;
     }
+    m_bEventIndexDirty = true;
 }
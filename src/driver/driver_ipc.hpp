@@ -2,21 +2,219 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
 #include <unordered_map>
 
+#include "event_index.hpp"
+#include "shared_send.hpp"
 #include "tracked_device_interfaces.hpp"
 
+struct sIpcSettings {
+    uint16_t nPort = 60000;
+
+    // 0 bounces every update to the other clients as it comes in,
+    // anything else sends them one Client_Snapshot of every device at this rate instead
+    int32_t nSnapshotRateHz = 0;
+
+    // threads handling messages on the connection strands, 0 is one per core.
+    // The sockets aren't on them, olc's context runs on the one thread Start() makes
+    int32_t nWorkerThreads = 0;
+
+    // outgoing messages a client can have waiting before updates for it start getting dropped
+    int32_t nMaxQueuedMessages = 64;
+
+    // how long the devices of a dropped connection wait for it to come back with its resume token, 0 turns resume off
+    int32_t nResumeTimeoutMs = 10000;
+
+    // devices added to vrserver up front, so the first clients don't wait for TrackedDeviceAdded and Activate.
+    // Controllers are per hand
+    int32_t nWarmTrackers = 0;
+    int32_t nWarmControllers = 0;
+
+    // how often the publisher thread hands new poses to vrserver, 0 does it as soon as one comes in
+    int32_t nPublishRateHz = 0;
+    // with nPublishRateHz at 0 the publisher still wakes up this often while prediction is on,
+    // a device that's late has to be extrapolated without an update to wake anyone up.
+    // The jitter buffer plays out on it, see FixedPublishRateHz
+    int32_t nPublishTickHz = 90;
+
+    // per device type, controllers usually want less latency and trackers more smoothing.
+    // Controllers can be set per hand on top
+    sPoseSettings trackerPose;
+    sPoseSettings controllerPose;
+    sPoseSettings leftControllerPose;
+    sPoseSettings rightControllerPose;
+
+    // any device type predicts, see nPublishTickHz
+    bool Predicts() const
+    {
+        for (const auto* pose : { &trackerPose, &controllerPose, &leftControllerPose, &rightControllerPose }) {
+            if (pose->prediction.fHorizon > 0)
+                return true;
+        }
+        return false;
+    }
+
+    // any device type buffers
+    bool Buffers() const
+    {
+        for (const auto* pose : { &trackerPose, &controllerPose, &leftControllerPose, &rightControllerPose }) {
+            if (pose->jitter.bEnabled)
+                return true;
+        }
+        return false;
+    }
+
+    // The rate the publisher runs at, 0 if updates wake it up. The jitter buffer needs an even cadence
+    // to play out on, so with it on anywhere the publisher runs on the tick even with nPublishRateHz at 0
+    int32_t FixedPublishRateHz() const
+    {
+        if (nPublishRateHz > 0)
+            return nPublishRateHz;
+        if (Buffers())
+            return std::max(nPublishTickHz, 1);
+        return 0;
+    }
+
+    const sPoseSettings& PoseSettingsFor(const DeviceType type, const DeviceRole role) const
+    {
+        if (type == DeviceType::Tracker)
+            return trackerPose;
+        if (role == DeviceRole::Left)
+            return leftControllerPose;
+        if (role == DeviceRole::Right)
+            return rightControllerPose;
+        return controllerPose;
+    }
+};
+
 class IpcServer : public olc::net::server_interface<HeaderStatus> {
+    // Everything of ours runs here, the strands, the udp socket and the workers. olc's m_asioContext
+    // only ever runs on its one thread, so its accept and read handlers and our writes never overlap.
+    // First, so it outlives everything made from it
+    asio::io_context m_work_context;
+    asio::executor_work_guard<asio::io_context::executor_type> m_work_guard;
+
 public:
-    IpcServer(uint16_t nPort);
+    IpcServer(const sIpcSettings& settings);
+    ~IpcServer();
+
+    // fills the warm pool, call it before Start()
+    void ProvisionDevices();
 
+    // olc's Start, but the connections it accepts are IpcConnections
+    bool Start();
+
+    // the threads running m_work_context, call it after Start()
+    void StartWorkers();
+    // the thread that hands poses to vrserver, nothing else calls TrackedDevicePoseUpdated
+    void StartPublisher();
+    // stops both asio contexts and waits for every worker and the publisher, after this no handler runs anymore
+    void Shutdown();
+
+    // Messages for one connection are handled in order on its strand, different connections run in parallel.
+    // The maps below are shared between them, each one has its own lock, never hold two at once.
+
+    std::shared_mutex m_roster_mutex;
     std::unordered_map<uint32_t, sDeviceNetPacket> m_mapPlayerRoster;
+
+    std::mutex m_garbage_mutex;
     std::vector<uint32_t> m_vGarbageIDs;
+
+    std::shared_mutex m_devices_mutex;
     std::unordered_map<uint32_t, std::unique_ptr<IHvrTrackedDevice>> my_tracker_devices;
-    std::vector<std::unique_ptr<IHvrTrackedDevice>> m_deactivated_devices;
+    // turned off devices waiting for a client, by PoolKey(type, role), a controller only ever comes back as the same hand
+    std::unordered_map<uint16_t, std::vector<std::unique_ptr<IHvrTrackedDevice>>> m_mapDevicePool;
+
+    // latest-wins slot for one device, an update that comes in before the strand got to
+    // the previous one replaces it, vrserver and the other clients only ever see the newest pose
+    struct sDeviceMailbox {
+        sShmSlot slot;
+        bool bFull = false;
+        // buttons of the full updates that got replaced, kept until a full update is drained
+        sSkippedButtons skipped;
+        bool bHasSequence = false;
+        uint32_t nLastSequence = 0;
+    };
+
+    // per connection state, lives from validation until the connection goes away
+    struct sIpcConnection {
+        sIpcConnection(asio::io_context& work_context, asio::io_context& net_context, std::shared_ptr<IpcConnection> client, const size_t max_queued);
+
+        std::shared_ptr<IpcConnection> connection;
+        // where the tcp connection comes from, datagrams for its devices have to come from there too
+        asio::ip::address peer;
+        // on m_work_context, the writer has its own on olc's context
+        SharedWriter::Strand strand;
+        // everything to the client goes through here, not MessageClient
+        std::shared_ptr<SharedWriter> writer;
+        // fan-out buffers built on the strand
+        SharedMessagePool pool;
+
+        // one per registered device of this connection, written from whichever thread got the update
+        std::mutex mailbox_mutex;
+        std::unordered_map<uint32_t, sDeviceMailbox> mailboxes;
+        std::atomic<bool> bDrainScheduled { false };
+        // what a drain took out of the mailboxes, only touched on the strand
+        struct sDrained {
+            uint32_t nUniqueID;
+            sShmSlot slot;
+            sSkippedButtons skipped;
+        };
+        std::vector<sDrained> vDrained;
+
+        // set once the client registered, the disconnect suspends its devices under it
+        std::atomic<uint64_t> nResumeToken { 0 };
+    };
+
+    struct sIpcClient {
+        std::shared_ptr<sIpcConnection> state;
+        uint32_t nSubscriptions = Subscribe_All;
+    };
+
+    std::shared_mutex m_clients_mutex;
+    // every validated connection by connection id
+    std::unordered_map<uint32_t, std::shared_ptr<sIpcConnection>> m_mapConnections;
+    // registered connections by connection id, used for fan-out
+    // and to route udp datagrams back to their tcp connection
+    std::unordered_map<uint32_t, sIpcClient> m_mapClients;
+
+    // a shared memory channel gets drained on its connection's strand, one drain at a time
+    struct sShmChannel {
+        hvr::shm::SharedObject<sShmDeviceChannel> shm;
+        std::atomic<bool> bDraining { false };
+    };
 
-    static constexpr const std::array<DeviceType, 2> m_supported_device_types = { { DeviceType::Tracker, DeviceType::ControllerViveLike } };
+    std::mutex m_shm_mutex;
+    // shared memory channels of same-host clients by device id
+    std::unordered_map<uint32_t, std::shared_ptr<sShmChannel>> m_mapShmChannels;
+    // channels get closed lazily, disconnects can happen while we are draining them
+    std::vector<uint32_t> m_vClosedShmChannels;
+
+    // devices of a connection that went away, turned off and kept aside until it comes back with its token
+    struct sSuspendedDevice {
+        sDeviceNetPacket desc;
+        std::unique_ptr<IHvrTrackedDevice> device;
+    };
+
+    struct sSuspendedSession {
+        std::chrono::steady_clock::time_point expires;
+        // by sub index
+        std::unordered_map<uint32_t, sSuspendedDevice> devices;
+    };
+
+    std::mutex m_sessions_mutex;
+    std::unordered_map<uint64_t, sSuspendedSession> m_mapSuspendedSessions;
+
+    static constexpr const std::array<DeviceType, 3> m_supported_device_types = { { DeviceType::Tracker, DeviceType::ControllerViveLike, DeviceType::ControllerIndexLike } };
 
 protected:
     bool OnClientConnect(std::shared_ptr<olc::net::connection<HeaderStatus>> client) override;
@@ -25,16 +223,161 @@ protected:
 
     void OnClientDisconnect(std::shared_ptr<olc::net::connection<HeaderStatus>> client) override;
 
+    // runs on the ipc thread, only hands msg over to the connection's strand
     void OnMessage(std::shared_ptr<olc::net::connection<HeaderStatus>> client, olc::net::message<HeaderStatus>& msg) override;
 
-    void OnDeviceAdded(std::shared_ptr<olc::net::connection<HeaderStatus>> client, const sDeviceNetPacket& desc);
+    void ProcessMessage(sIpcConnection& conn, olc::net::message<HeaderStatus>& msg);
+
+    void OnDeviceAdded(const sDeviceNetPacket& desc);
+
+    // a new device, not added to vrserver yet
+    std::unique_ptr<IHvrTrackedDevice> CreateDevice(const uint32_t serial_id, const DeviceType type, const DeviceRole role);
+
+    bool AddToVrServer(IHvrTrackedDevice& device);
+
+    // Keeps the roster (and the delta chain) up to date right away and puts the pose in the device's mailbox,
+    // called from wherever the update came in. sequence is only there for datagrams, older ones get dropped
+    void EnqueueDeviceUpdate(const std::shared_ptr<sIpcConnection>& conn, const uint32_t pid, HeaderStatus id, hvr::net::ByteView body, const std::optional<uint32_t> sequence);
+
+    // runs on the strand, hands whatever is in the mailboxes to HandleDeviceUpdate
+    void DrainMailboxes(sIpcConnection& conn);
 
-    void OnDeviceUpdate(std::shared_ptr<olc::net::connection<HeaderStatus>> client, olc::net::message<HeaderStatus>& msg);
+    // runs on the strand, bounces one pose and passes it to the device
+    void HandleDeviceUpdate(const uint32_t pid, sIpcConnection& conn, const HeaderStatus id, const hvr::net::ByteView body, const sSkippedButtons& skipped);
+
+    // OnClientDisconnect for each of them that's still in m_deqConnections, the rest someone else got to first
+    void DropConnections(std::vector<std::shared_ptr<olc::net::connection<HeaderStatus>>>& disconnected);
+
+    // like MessageAllClients, but only to registered clients that subscribed to flag,
+    // msg is shared between all of them instead of being copied for each
+    void MessageSubscribers(const SharedMessage& msg, const SubscribeFlags flag, std::shared_ptr<olc::net::connection<HeaderStatus>> pIgnoreClient = nullptr);
+
+    // false if pid isn't in the roster (anymore)
+    bool StoreKeyframe(const uint32_t pid, const uint8_t* packet);
+
+    // tcp and the shared memory ring both end up here, on the connection's strand
+    void OnDeviceBatch(sIpcConnection& conn, const hvr::net::ByteView body);
+
+    void BounceDeviceUpdate(const uint32_t pid, sIpcConnection& conn, const HeaderStatus id, const hvr::net::ByteView body);
+
+    void OnDeviceUpdate(const uint32_t pid, const HeaderStatus id, const hvr::net::ByteView body, const sSkippedButtons& skipped = {});
+
+    // wakes the publisher up, unless it runs at a fixed rate anyway
+    void NotifyPublisher();
+
+    void PublishPoses();
+
+    void DrainSharedMemory(const std::shared_ptr<sIpcConnection>& conn, const uint32_t pid, sShmChannel& channel);
 
     void OnDeviceRemove(const uint32_t pid);
 
+    // from the interests of every device in my_tracker_devices, m_devices_mutex has to be held
+    void RebuildEventIndex();
+
+    // takes the device out of my_tracker_devices and turns it off, nullptr if there is none
+    std::unique_ptr<IHvrTrackedDevice> DetachDevice(const uint32_t pid);
+
+    // back to the pool for whoever registers next
+    void ParkDevice(std::unique_ptr<IHvrTrackedDevice> device);
+
+    // Rebinds the devices suspended under token to conn, with the ids of the new connection.
+    // The main device's roster entry has to be in already, false if there was nothing to resume
+    bool ResumeSession(sIpcConnection& conn, const uint64_t token, const sDeviceNetPacket& desc);
+
 public:
+    // only to the devices that asked for it, see hGetEventInterests
     void OnVRevent(const vr::VREvent_t& event);
 
+    // sends the haptic pulses of this frame to the connections of the devices that got them,
+    // called from RunFrame once the frame's events are through
+    void FlushHaptics();
+
+    // hands shared memory rings with something in them to their strand, called from the ipc thread next to Update()
+    void PollSharedMemory();
+
+    // sends out a Client_Snapshot if snapshots are on and one is due, called from the ipc thread next to Update().
+    // Doesn't reap anything itself, run ReapConnections() first so dead clients don't get one
+    void BroadcastSnapshot();
+
+    // keeps the message rate for Server_GetStatus and logs the coalesce, stale and outgoing drop counters
+    // every now and then if they moved, called from the ipc thread next to Update()
+    void ReportCounters();
+
+    // Server_GetStatus reply
+    sServerStatus GetStatus();
+
+    // parks the devices of sessions that didn't come back in time, called from the ipc thread next to Update()
+    void ExpireSessions();
+
+    // disconnects every connection whose socket is gone, whether anything gets sent to it or not.
+    // Called from the ipc thread next to Update()
+    void ReapConnections();
+
+    // every message that came in, over any transport
+    std::atomic<uint64_t> m_nMessagesIn { 0 };
+
+    // updates that got replaced in a mailbox before anyone looked at them, the backlog we skipped
+    std::atomic<uint64_t> m_nCoalescedUpdates { 0 };
+    // datagrams that showed up after a newer one for the same device
+    std::atomic<uint64_t> m_nStaleUpdates { 0 };
+    // outgoing updates to clients that fell behind, from writers that are gone by now
+    std::atomic<uint64_t> m_nDroppedOutgoing { 0 };
+
+    // dropped outgoing updates of every client so far
+    uint64_t DroppedOutgoing();
+
     void StopAllDevices();
+
+private:
+    // olc's WaitForClientConnection, making IpcConnections instead of plain connections
+    void AcceptNext();
+
+    void ReceiveDatagram();
+
+    sIpcSettings m_settings;
+
+    std::vector<std::thread> m_vWorkers;
+
+    uint32_t m_nNextWarmSerial = 1;
+
+    std::thread m_publisher;
+    std::atomic<bool> m_bPublishing { false };
+    std::atomic<bool> m_bPublishPending { false };
+    std::mutex m_publish_mutex;
+    std::condition_variable m_publish_cv;
+
+    std::chrono::steady_clock::time_point m_next_snapshot;
+    std::atomic<bool> m_snapshot_dirty { false };
+    // only the ipc thread builds snapshots
+    SharedMessagePool m_snapshot_pool { 4, sizeof(sDeviceNetPacket) + sizeof(uint32_t) };
+
+    // set whenever my_tracker_devices changes or a device activates, OnVRevent rebuilds the index before the next event
+    std::atomic<bool> m_bEventIndexDirty { true };
+    // only touched on the RunFrame thread, with m_devices_mutex held shared
+    EventIndex m_event_index;
+    std::vector<sEventInterest> m_vInterests;
+
+    // devices OnVRevent handed a haptic pulse to this frame, by pid. Only RunFrame builds haptic messages
+    std::vector<uint32_t> m_vPendingHaptics;
+    std::vector<sHapticPulse> m_vHaptics;
+    SharedMessagePool m_haptic_pool { 8, sizeof(sHapticPulse) };
+
+    std::chrono::steady_clock::time_point m_next_rate_sample;
+    uint64_t m_nLastMessagesIn = 0;
+    std::atomic<uint32_t> m_nMessagesPerSecond { 0 };
+
+    std::chrono::steady_clock::time_point m_next_report;
+    std::chrono::steady_clock::time_point m_next_reap;
+    uint64_t m_nReportedCoalesced = 0;
+    uint64_t m_nReportedStale = 0;
+    uint64_t m_nReportedDropped = 0;
+
+    // olc's m_deqConnections, only ever touched with this held: AcceptNext adds to it, MessageSubscribers cleans up.
+    // olc's MessageClient and MessageAllClients go through it without, don't call them
+    std::mutex m_connections_mutex;
+
+    // udp fast path for Client_UpdateDevice, bound to the same port as the tcp listener
+    asio::ip::udp::socket m_udp_socket;
+    asio::ip::udp::endpoint m_udp_remote;
+    std::array<uint8_t, k_nMaxDatagramSize> m_udp_buffer;
 };
@@ -2,8 +2,54 @@
 
 #include "driver_provider.h"
 
+#include "driver_settings.hpp"
 #include "driverlog.h"
 
+#include <string>
+
+namespace {
+
+// milliseconds in the settings, seconds in the code
+double GetSettingMs(const std::string& key, const double fallback)
+{
+    return GetSettingInt(key.c_str(), static_cast<int32_t>(fallback * 1000)) / 1000.0;
+}
+
+PoseFilterType GetSettingFilter(const std::string& key, const PoseFilterType fallback)
+{
+    const std::string name = GetSettingString(key.c_str(), "");
+    if (name == "passthrough" || name == "none")
+        return PoseFilterType::Passthrough;
+    if (name == "one_euro")
+        return PoseFilterType::OneEuro;
+    if (name == "kalman")
+        return PoseFilterType::Kalman;
+    if (!name.empty())
+        DriverLog("unknown %s \"%s\"", key.c_str(), name.c_str());
+    return fallback;
+}
+
+// "" reads the keys everything shares, "_tracker", "_controller" and so on the overrides on top of them
+sPoseSettings GetPoseSettings(const std::string& suffix, const sPoseSettings& fallback)
+{
+    sPoseSettings pose = fallback;
+    pose.filter.type = GetSettingFilter("pose_filter" + suffix, pose.filter.type);
+    pose.filter.fMinCutoff = GetSettingFloat(("filter_min_cutoff" + suffix).c_str(), static_cast<float>(pose.filter.fMinCutoff));
+    pose.filter.fBeta = GetSettingFloat(("filter_beta" + suffix).c_str(), static_cast<float>(pose.filter.fBeta));
+    pose.filter.fDerivativeCutoff = GetSettingFloat(("filter_d_cutoff" + suffix).c_str(), static_cast<float>(pose.filter.fDerivativeCutoff));
+    pose.filter.fAccelNoise = GetSettingFloat(("kalman_accel_noise" + suffix).c_str(), static_cast<float>(pose.filter.fAccelNoise));
+    pose.filter.fMeasurementNoise = GetSettingFloat(("kalman_position_noise_mm" + suffix).c_str(), static_cast<float>(pose.filter.fMeasurementNoise * 1000)) / 1000.0;
+    pose.prediction.fHorizon = GetSettingMs("prediction_horizon_ms" + suffix, pose.prediction.fHorizon);
+    pose.prediction.fBlendTime = GetSettingMs("prediction_blend_ms" + suffix, pose.prediction.fBlendTime);
+    pose.jitter.bEnabled = GetSettingBool(("jitter_buffer" + suffix).c_str(), pose.jitter.bEnabled);
+    pose.jitter.fMinDelay = GetSettingMs("jitter_min_delay_ms" + suffix, pose.jitter.fMinDelay);
+    pose.jitter.fMaxDelay = GetSettingMs("jitter_max_delay_ms" + suffix, pose.jitter.fMaxDelay);
+    pose.jitter.fJitterScale = GetSettingFloat(("jitter_scale" + suffix).c_str(), static_cast<float>(pose.jitter.fJitterScale));
+    return pose;
+}
+
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: This is called by vrserver after it receives a pointer back from HmdDriverFactory.
 // You should do your resources allocations here (**not** in the constructor).
@@ -14,15 +60,35 @@ vr::EVRInitError HvrDeviceProvider::Init(vr::IVRDriverContext* pDriverContext)
     // OpenVR provides a macro to do this for us.
     VR_INIT_SERVER_DRIVER_CONTEXT(pDriverContext);
 
-    m_ipc_server = std::make_unique<IpcServer>(60000);
+    sIpcSettings settings;
+    settings.nPort = static_cast<uint16_t>(GetSettingInt("ipc_port", settings.nPort));
+    settings.nSnapshotRateHz = GetSettingInt("snapshot_rate_hz", settings.nSnapshotRateHz);
+    settings.nWorkerThreads = GetSettingInt("ipc_worker_threads", settings.nWorkerThreads);
+    settings.nMaxQueuedMessages = GetSettingInt("ipc_max_queued_messages", settings.nMaxQueuedMessages);
+    settings.nResumeTimeoutMs = GetSettingInt("resume_timeout_ms", settings.nResumeTimeoutMs);
+    settings.nWarmTrackers = GetSettingInt("warm_trackers", settings.nWarmTrackers);
+    settings.nWarmControllers = GetSettingInt("warm_controllers", settings.nWarmControllers);
+    settings.nPublishRateHz = GetSettingInt("publish_rate_hz", settings.nPublishRateHz);
+    settings.nPublishTickHz = GetSettingInt("publish_tick_hz", settings.nPublishTickHz);
+    const sPoseSettings pose = GetPoseSettings("", {});
+    settings.trackerPose = GetPoseSettings("_tracker", pose);
+    settings.controllerPose = GetPoseSettings("_controller", pose);
+    settings.leftControllerPose = GetPoseSettings("_controller_left", settings.controllerPose);
+    settings.rightControllerPose = GetPoseSettings("_controller_right", settings.controllerPose);
+
+    m_ipc_server = std::make_unique<IpcServer>(settings);
     if (!m_ipc_server) {
         DriverLog("COULD NOT INIT SERVER!!!");
         return vr::VRInitError_IPC_NamespaceUnavailable;
     }
 
+    m_ipc_server->ProvisionDevices();
+
     m_ipc_is_active = true;
 
     m_ipc_server->Start();
+    m_ipc_server->StartWorkers();
+    m_ipc_server->StartPublisher();
 
     m_ipc_thread = std::thread(&HvrDeviceProvider::MyIpcThread, this);
 
@@ -61,6 +127,7 @@ void HvrDeviceProvider::RunFrame()
     while (vr::VRServerDriverHost()->PollNextEvent(&vrevent, sizeof(vr::VREvent_t))) {
         m_ipc_server->OnVRevent(vrevent);
     }
+    m_ipc_server->FlushHaptics();
 }
 
 void HvrDeviceProvider::MyIpcThread()
@@ -70,6 +137,11 @@ void HvrDeviceProvider::MyIpcThread()
 
     while (m_ipc_is_active) {
         m_ipc_server->Update(-1, false);
+        m_ipc_server->PollSharedMemory();
+        m_ipc_server->ReapConnections();
+        m_ipc_server->BroadcastSnapshot();
+        m_ipc_server->ReportCounters();
+        m_ipc_server->ExpireSessions();
     }
 }
 
@@ -102,6 +174,8 @@ void HvrDeviceProvider::Cleanup()
     }
 
     if (m_ipc_server) {
+        // no handler can touch a device after this
+        m_ipc_server->Shutdown();
         m_ipc_server->StopAllDevices();
     }
     m_ipc_server.reset(nullptr);
@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include "driver_settings.hpp"
+
+int32_t GetSettingInt(const char* key, const int32_t fallback)
+{
+    vr::EVRSettingsError err = vr::VRSettingsError_None;
+    const int32_t value = vr::VRSettings()->GetInt32(hvr_settings_section, key, &err);
+    return err == vr::VRSettingsError_None ? value : fallback;
+}
+
+float GetSettingFloat(const char* key, const float fallback)
+{
+    vr::EVRSettingsError err = vr::VRSettingsError_None;
+    const float value = vr::VRSettings()->GetFloat(hvr_settings_section, key, &err);
+    return err == vr::VRSettingsError_None ? value : fallback;
+}
+
+bool GetSettingBool(const char* key, const bool fallback)
+{
+    vr::EVRSettingsError err = vr::VRSettingsError_None;
+    const bool value = vr::VRSettings()->GetBool(hvr_settings_section, key, &err);
+    return err == vr::VRSettingsError_None ? value : fallback;
+}
+
+std::string GetSettingString(const char* key, const std::string& fallback)
+{
+    vr::EVRSettingsError err = vr::VRSettingsError_None;
+    char value[256] = {};
+    vr::VRSettings()->GetString(hvr_settings_section, key, value, sizeof(value), &err);
+    return err == vr::VRSettingsError_None ? value : fallback;
+}
@@ -0,0 +1,17 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include "openvr_driver.h"
+
+#include <cstdint>
+#include <string>
+
+// Our settings live in the "driver_asiotest" section, see resources/settings/default.vrsettings.
+// All of these fall back to the given default if the key is missing.
+static constexpr const char* hvr_settings_section = "driver_asiotest";
+
+int32_t GetSettingInt(const char* key, const int32_t fallback);
+float GetSettingFloat(const char* key, const float fallback);
+bool GetSettingBool(const char* key, const bool fallback);
+std::string GetSettingString(const char* key, const std::string& fallback);
@@ -4,6 +4,7 @@
 
 #include "driver_vrmath.h"
 #include "driverlog.h"
+#include "pose_decode.hpp"
 
 // Let's create some variables for strings used in getting settings.
 // This is the section where all of the settings we want are stored. A section name can be anything,
@@ -90,6 +91,14 @@ vr::EVRInitError MyTrackerDeviceDriver::Activate(uint32_t unObjectId)
     vr::VRDriverInput()->CreateBooleanComponent(
         container, "/input/trigger/click", &input_handles_[MyComponent_trigger_click]);
 
+    // where the client's bBoolStates and aFloatStates end up, hProcessMsg only passes on what changed
+    input_mapper_.AddBoolean(input_handles_[MyComponent_a_click], InputBit_AClick);
+    input_mapper_.AddBoolean(input_handles_[MyComponent_a_touch], InputBit_ATouch);
+    input_mapper_.AddBoolean(input_handles_[MyComponent_trigger_click], InputBit_TriggerClick);
+    input_mapper_.AddScalar(input_handles_[MyComponent_trigger_value], InputFloat_Trigger);
+    // new handles, nothing we remember about the old ones applies
+    input_mapper_.Invalidate();
+
     // my_pose_update_thread_ = std::thread(&MyTrackerDeviceDriver::MyPoseUpdateThread, this);
 
     // We've activated everything successfully!
@@ -219,101 +228,57 @@ void MyTrackerDeviceDriver::Deactivate()
 
     // unassign our controller index (we don't want to be calling vrserver anymore after Deactivate() has been called
     my_device_index_ = vr::k_unTrackedDeviceIndexInvalid;
+    input_mapper_.Clear();
 }
 
 void MyTrackerDeviceDriver::hTurnOff()
 {
-    vr::DriverPose_t pose = { 0 };
-
-    // The pose we provided is valid.
-    // This should be set is
-    pose.poseIsValid = true;
-
-    // Our device is always connected.
-    // In reality with physical devices, when they get disconnected,
-    // set this to false and icons in SteamVR will be updated to show the device is disconnected
-    pose.deviceIsConnected = false;
-
-    // The state of our tracking. For our virtual device, it's always going to be ok,
-    // but this can get set differently to inform the runtime about the state of the device's tracking
-    // and update the icons to inform the user accordingly.
-    pose.result = vr::TrackingResult_Running_OK;
-
-    // Inform the vrserver that our tracked device's pose has updated, giving it the pose returned by our GetPose().
-    vr::VRServerDriverHost()->TrackedDevicePoseUpdated(my_device_index_, pose, sizeof(pose));
+    // the publisher tells vrserver
+    is_on_ = false;
 }
 
 void MyTrackerDeviceDriver::hTurnOn()
 {
-    vr::DriverPose_t pose = { 0 };
-
-    // The pose we provided is valid.
-    // This should be set is
-    pose.poseIsValid = true;
-
-    // Our device is always connected.
-    // In reality with physical devices, when they get disconnected,
-    // set this to false and icons in SteamVR will be updated to show the device is disconnected
-    pose.deviceIsConnected = true;
-
-    // The state of our tracking. For our virtual device, it's always going to be ok,
-    // but this can get set differently to inform the runtime about the state of the device's tracking
-    // and update the icons to inform the user accordingly.
-    pose.result = vr::TrackingResult_Running_OK;
-
-    // Inform the vrserver that our tracked device's pose has updated, giving it the pose returned by our GetPose().
-    vr::VRServerDriverHost()->TrackedDevicePoseUpdated(my_device_index_, pose, sizeof(pose));
+    // the publisher tells vrserver
+    is_on_ = true;
+    // a new client, vrserver still has the buttons of the last one
+    input_mapper_.Invalidate();
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: This is called by our IServerTrackedDeviceProvider when its RunFrame() method gets called.
+// Purpose: This is called by our IServerTrackedDeviceProvider when it pops an event off the event queue.
 // It's not part of the ITrackedDeviceServerDriver interface, we created it ourselves.
 //-----------------------------------------------------------------------------
-void MyTrackerDeviceDriver::MyRunFrame()
+bool MyTrackerDeviceDriver::hProcessEvent(const vr::VREvent_t& vrevent)
 {
-    // update our inputs here
-    vr::VRDriverInput()->UpdateBooleanComponent(input_handles_[MyComponent_a_click], false, 0);
-    vr::VRDriverInput()->UpdateBooleanComponent(input_handles_[MyComponent_a_touch], false, 0);
+    // Our tracker doesn't have any events it wants to process.
+    return false;
+}
 
-    vr::VRDriverInput()->UpdateBooleanComponent(input_handles_[MyComponent_trigger_click], false, 0);
-    vr::VRDriverInput()->UpdateScalarComponent(input_handles_[MyComponent_trigger_value], 0.f, 0);
+void MyTrackerDeviceDriver::hGetEventInterests(std::vector<sEventInterest>& interests)
+{
+    // nothing, see hProcessEvent
 }
 
-//-----------------------------------------------------------------------------
-// Purpose: This is called by our IServerTrackedDeviceProvider when it pops an event off the event queue.
-// It's not part of the ITrackedDeviceServerDriver interface, we created it ourselves.
-//-----------------------------------------------------------------------------
-void MyTrackerDeviceDriver::hProcessEvent(const vr::VREvent_t& vrevent)
+bool MyTrackerDeviceDriver::hTakeHaptic(sHapticPulse& pulse)
 {
-    // Our tracker doesn't have any events it wants to process.
+    // no haptic component
+    return false;
 }
 
 //-----------------------------------------------------------------------------
 // Purpose: Meh idk, ipc update
 //-----------------------------------------------------------------------------
-void MyTrackerDeviceDriver::hProcessMsg(olc::net::message<HeaderStatus>& msg)
+void MyTrackerDeviceDriver::hProcessMsg(const HeaderStatus id, const hvr::net::ByteView body, const sSkippedButtons& skipped)
 {
-    sDeviceNetPacket desc;
-    msg >> desc;
-
     vr::DriverPose_t pose = { 0 };
-    // copy our position to our pose
-    pose.vecPosition[0] = desc.vPos.x - 3;
-    pose.vecPosition[1] = desc.vPos.y;
-    pose.vecPosition[2] = desc.vPos.z - 3;
-
-    pose.vecVelocity[0] = desc.vVel.x;
-    pose.vecVelocity[1] = desc.vVel.y;
-    pose.vecVelocity[2] = desc.vVel.z;
+    if (!DecodeDevicePose(id, body, pose)) {
+        return;
+    }
 
-    pose.qRotation.w = desc.vRot.w;
-    pose.qRotation.x = desc.vRot.x;
-    pose.qRotation.y = desc.vRot.y;
-    pose.qRotation.z = desc.vRot.z;
-
-    pose.vecAngularVelocity[0] = desc.vAngVel.x;
-    pose.vecAngularVelocity[1] = desc.vAngVel.y;
-    pose.vecAngularVelocity[2] = desc.vAngVel.z;
+    // the demo client spawns its devices at (3, 0, 3)
+    pose.vecPosition[0] -= 3;
+    pose.vecPosition[2] -= 3;
 
     // The pose we provided is valid.
     // This should be set is
@@ -329,8 +294,22 @@ void MyTrackerDeviceDriver::hProcessMsg(olc::net::message<HeaderStatus>& msg)
     // and update the icons to inform the user accordingly.
     pose.result = vr::TrackingResult_Running_OK;
 
-    // Inform the vrserver that our tracked device's pose has updated, giving it the pose returned by our GetPose().
-    vr::VRServerDriverHost()->TrackedDevicePoseUpdated(my_device_index_, pose, sizeof(pose));
+    // inputs go out right away, with the same time offset as the pose they came with
+    input_mapper_.Update(id, body, pose.poseTimeOffset, skipped);
+
+    // The publisher thread picks it up from here, only the newest one gets to vrserver.
+    pose_slot_.Write(pose, hvr::clock::NowMicros());
+}
+
+void MyTrackerDeviceDriver::hPublish()
+{
+    // a warm device sits in the pool disconnected until a client takes it
+    pose_pipeline_.Publish(my_device_index_, is_on_, pose_slot_);
+}
+
+void MyTrackerDeviceDriver::hSetPoseSettings(const sPoseSettings& settings)
+{
+    pose_pipeline_.Configure(settings, pose_slot_);
 }
 
 //-----------------------------------------------------------------------------
@@ -346,3 +325,8 @@ DeviceType MyTrackerDeviceDriver::hGetDeviceType()
 {
     return DeviceType::Tracker;
 }
+
+DeviceRole MyTrackerDeviceDriver::hGetDeviceRole()
+{
+    return DeviceRole::Neither;
+}
@@ -4,6 +4,8 @@
 
 #include "common.hpp"
 #include "openvr_driver.h"
+#include "input_mapper.hpp"
+#include "pose_slot.hpp"
 #include "tracked_device_interfaces.hpp"
 
 #include <array>
@@ -45,22 +47,31 @@ public:
 
     const std::string& hGetSerialNumber() override;
 
-    void MyRunFrame();
-    void hProcessEvent(const vr::VREvent_t& vrevent) override;
-    void hProcessMsg(olc::net::message<HeaderStatus>& msg) override;
+    bool hProcessEvent(const vr::VREvent_t& vrevent) override;
+    bool hTakeHaptic(sHapticPulse& pulse) override;
+    void hGetEventInterests(std::vector<sEventInterest>& interests) override;
+    void hProcessMsg(const HeaderStatus id, const hvr::net::ByteView body, const sSkippedButtons& skipped) override;
+    void hPublish() override;
+    void hSetPoseSettings(const sPoseSettings& settings) override;
     void hTurnOff() override;
     void hTurnOn() override;
     DeviceType hGetDeviceType() override;
+    DeviceRole hGetDeviceRole() override;
 
     void MyPoseUpdateThread();
 
 private:
     unsigned int my_tracker_id_;
 
-    std::atomic<vr::TrackedDeviceIndex_t> my_device_index_;
+    std::atomic<vr::TrackedDeviceIndex_t> my_device_index_ { vr::k_unTrackedDeviceIndexInvalid };
+    std::atomic<bool> is_on_ { true };
+
+    PoseSlot pose_slot_;
+    PosePipeline pose_pipeline_;
 
     std::string my_device_model_number_;
     std::string my_device_serial_number_;
 
     std::array<vr::VRInputComponentHandle_t, MyComponent_MAX> input_handles_;
+    InputMapper input_mapper_;
 };
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include "event_index.hpp"
+
+static uint64_t DeviceKey(const uint32_t event_type, const vr::TrackedDeviceIndex_t index)
+{
+    return static_cast<uint64_t>(event_type) << 32 | index;
+}
+
+// the component an event is about, if it carries one
+static vr::VRInputComponentHandle_t ComponentOf(const vr::VREvent_t& event)
+{
+    switch (event.eventType) {
+    case vr::VREvent_Input_HapticVibration:
+        return event.data.hapticVibration.componentHandle;
+    default:
+        return vr::k_ulInvalidInputComponentHandle;
+    }
+}
+
+void EventIndex::Clear()
+{
+    m_mapByType.clear();
+    m_mapByDevice.clear();
+    m_mapByComponent.clear();
+}
+
+void EventIndex::Add(const uint32_t pid, IHvrTrackedDevice* device, const sEventInterest& interest)
+{
+    const sEntry entry = { pid, device };
+    switch (interest.eMatch) {
+    case sEventInterest::Match::Any:
+        m_mapByType[interest.nEventType].push_back(entry);
+        break;
+    case sEventInterest::Match::DeviceIndex:
+        m_mapByDevice[DeviceKey(interest.nEventType, static_cast<vr::TrackedDeviceIndex_t>(interest.nKey))].push_back(entry);
+        break;
+    case sEventInterest::Match::Component:
+        m_mapByComponent[interest.nKey].emplace_back(interest.nEventType, entry);
+        break;
+    }
+}
+
+void EventIndex::Dispatch(const vr::VREvent_t& event, std::vector<uint32_t>& haptics) const
+{
+    if (const auto res = m_mapByType.find(event.eventType); res != m_mapByType.end()) {
+        for (const auto& entry : res->second) {
+            if (entry.device->hProcessEvent(event))
+                haptics.push_back(entry.nUniqueID);
+        }
+    }
+
+    if (const auto res = m_mapByDevice.find(DeviceKey(event.eventType, event.trackedDeviceIndex)); res != m_mapByDevice.end()) {
+        for (const auto& entry : res->second) {
+            if (entry.device->hProcessEvent(event))
+                haptics.push_back(entry.nUniqueID);
+        }
+    }
+
+    const auto component = ComponentOf(event);
+    if (component == vr::k_ulInvalidInputComponentHandle)
+        return;
+
+    if (const auto res = m_mapByComponent.find(component); res != m_mapByComponent.end()) {
+        for (const auto& [event_type, entry] : res->second) {
+            if (event_type == event.eventType && entry.device->hProcessEvent(event))
+                haptics.push_back(entry.nUniqueID);
+        }
+    }
+}
@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "tracked_device_interfaces.hpp"
+
+// Who gets which VREvent_t, so RunFrame doesn't hand every event to every device.
+// Built from the devices' hGetEventInterests, only ever touched on vrserver's RunFrame thread.
+class EventIndex {
+public:
+    void Clear();
+
+    // pid is the id the device is registered under right now, it's what Dispatch reports back
+    void Add(const uint32_t pid, IHvrTrackedDevice* device, const sEventInterest& interest);
+
+    // hProcessEvent on every device with an interest that matches,
+    // the ones that got a haptic pulse out of it go on haptics
+    void Dispatch(const vr::VREvent_t& event, std::vector<uint32_t>& haptics) const;
+
+private:
+    struct sEntry {
+        uint32_t nUniqueID;
+        IHvrTrackedDevice* device;
+    };
+    using Devices = std::vector<sEntry>;
+
+    // Match::Any, by event type
+    std::unordered_map<uint32_t, Devices> m_mapByType;
+    // Match::DeviceIndex, by event type and tracked device index
+    std::unordered_map<uint64_t, Devices> m_mapByDevice;
+    // Match::Component, by component handle, with the event type they want
+    std::unordered_map<uint64_t, std::vector<std::pair<uint32_t, sEntry>>> m_mapByComponent;
+};
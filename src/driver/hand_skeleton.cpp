@@ -0,0 +1,237 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include "hand_skeleton.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "hvr_math.hpp"
+
+namespace {
+
+constexpr uint32_t k_nBones = HandSkeleton::k_nBones;
+constexpr size_t k_nFingers = HandSkeleton::k_nFingers;
+
+// bone indices of the OpenVR hand skeleton
+constexpr uint32_t k_nThumb0 = 2;
+constexpr uint32_t k_nIndex0 = 6;
+constexpr uint32_t k_nBonesPerFinger = 5;
+constexpr uint32_t k_nAux0 = 26;
+
+// a rough hand, not the SteamVR reference pose. Left hand, fingers along +x, palm towards -y, thumb on +z
+struct sFingerShape {
+    hvr::math::vec3f vBase;
+    // from each joint to the next, the last one to the tip
+    std::array<float, 4> aLength;
+    // how far each joint bends with the finger fully curled, in radians
+    std::array<float, 4> aCurl;
+    // how far the first joint goes sideways at full splay
+    float fSplay;
+};
+
+constexpr std::array<sFingerShape, k_nFingers> k_aFingers = { {
+    { { 0.020f, -0.015f, 0.025f }, { 0.045f, 0.035f, 0.030f, 0 }, { 0.5f, 0.7f, 0.9f, 0 }, 0.4f },
+    { { 0, 0, 0.020f }, { 0.070f, 0.045f, 0.027f, 0.022f }, { 0, 1.4f, 1.7f, 1.2f }, 0.3f },
+    { { 0, 0, 0 }, { 0.068f, 0.050f, 0.030f, 0.024f }, { 0, 1.4f, 1.7f, 1.2f }, 0.15f },
+    { { 0, 0, -0.018f }, { 0.065f, 0.047f, 0.029f, 0.023f }, { 0.05f, 1.4f, 1.7f, 1.2f }, 0.2f },
+    { { 0, -0.005f, -0.035f }, { 0.060f, 0.037f, 0.022f, 0.020f }, { 0.1f, 1.4f, 1.7f, 1.2f }, 0.3f },
+} };
+
+// Everything that doesn't depend on the input, split into one array per component so the kernel is
+// a straight loop over plain floats the compiler can vectorize.
+// Bones are parent relative, so only the rotations move, the positions are fixed.
+struct sBoneTable {
+    std::array<vr::HmdVector4_t, k_nBones> aPosition;
+    // full curl, the open hand is identity
+    std::array<float, k_nBones> aCurlW, aCurlX, aCurlY, aCurlZ;
+    // tan of half the full splay, 0 for bones that don't splay
+    std::array<float, k_nBones> aSplay;
+    // which finger drives the bone, k_nFingers for none
+    std::array<uint8_t, k_nBones> aFinger;
+    // joint to joint chain of each finger up to the last bone before the tip, for the aux bones
+    std::array<std::array<uint32_t, 4>, k_nFingers> aChain;
+    std::array<uint8_t, k_nFingers> aChainLength;
+};
+
+sBoneTable BuildLeftHand()
+{
+    sBoneTable table;
+    for (uint32_t b = 0; b < k_nBones; b++) {
+        table.aPosition[b] = { { 0, 0, 0, 1 } };
+        table.aCurlW[b] = 1;
+        table.aCurlX[b] = table.aCurlY[b] = table.aCurlZ[b] = 0;
+        table.aSplay[b] = 0;
+        table.aFinger[b] = static_cast<uint8_t>(k_nFingers);
+    }
+
+    for (size_t f = 0; f < k_nFingers; f++) {
+        const auto& shape = k_aFingers[f];
+        // the thumb has no metacarpal in the skeleton, one bone less
+        const uint32_t first = f == 0 ? k_nThumb0 : k_nIndex0 + static_cast<uint32_t>(f - 1) * k_nBonesPerFinger;
+        const uint32_t count = f == 0 ? 4 : k_nBonesPerFinger;
+
+        for (uint32_t i = 0; i < count; i++) {
+            const uint32_t b = first + i;
+            if (i == 0)
+                table.aPosition[b] = { { shape.vBase.x, shape.vBase.y, shape.vBase.z, 1 } };
+            else
+                table.aPosition[b] = { { shape.aLength[i - 1], 0, 0, 1 } };
+
+            // the tip doesn't bend
+            if (i + 1 == count)
+                continue;
+
+            // curling bends towards the palm, around -z
+            const float half = -shape.aCurl[i] / 2;
+            table.aCurlW[b] = std::cos(half);
+            table.aCurlZ[b] = std::sin(half);
+            table.aFinger[b] = static_cast<uint8_t>(f);
+            table.aChain[f][i] = b;
+        }
+        table.aChainLength[f] = static_cast<uint8_t>(count - 1);
+
+        // the joint that spreads the fingers, the first one that isn't a metacarpal.
+        // Around -y, so positive splay moves towards the thumb
+        const uint32_t splay_bone = f == 0 ? first : first + 1;
+        table.aSplay[splay_bone] = -std::tan(shape.fSplay / 2);
+    }
+    return table;
+}
+
+// mirrored across x = 0
+sBoneTable BuildRightHand()
+{
+    sBoneTable table = BuildLeftHand();
+    for (uint32_t b = 0; b < k_nBones; b++) {
+        table.aPosition[b].v[0] = -table.aPosition[b].v[0];
+        table.aCurlY[b] = -table.aCurlY[b];
+        table.aCurlZ[b] = -table.aCurlZ[b];
+        table.aSplay[b] = -table.aSplay[b];
+    }
+    return table;
+}
+
+const sBoneTable& BoneTable(const bool right)
+{
+    static const sBoneTable left_hand = BuildLeftHand();
+    static const sBoneTable right_hand = BuildRightHand();
+    return right ? right_hand : left_hand;
+}
+
+hvr::math::vec3f Rotate(const hvr::math::quatf& q, const hvr::math::vec3f& v)
+{
+    const auto r = q * hvr::math::quatf { 0, v.x, v.y, v.z } * hvr::math::conj(q);
+    return { r.x, r.y, r.z };
+}
+
+// curls and splays in, parent relative bone transforms out
+void ExpandBones(const sBoneTable& table, const std::array<float, k_nFingers + 1>& curl, const std::array<float, k_nFingers + 1>& splay,
+    std::array<vr::VRBoneTransform_t, k_nBones>& bones)
+{
+    // gathered up front, the loop below is then nothing but arithmetic on flat arrays
+    std::array<float, k_nBones> bone_curl, bone_splay;
+    for (uint32_t b = 0; b < k_nBones; b++) {
+        bone_curl[b] = curl[table.aFinger[b]];
+        bone_splay[b] = splay[table.aFinger[b]];
+    }
+
+    std::array<float, k_nBones> w, x, y, z;
+    for (uint32_t b = 0; b < k_nBones; b++) {
+        const float c = bone_curl[b];
+        const float s = bone_splay[b] * table.aSplay[b];
+
+        // nlerp from the open hand to the full curl
+        const float cw = 1 + (table.aCurlW[b] - 1) * c;
+        const float cx = table.aCurlX[b] * c;
+        const float cy = table.aCurlY[b] * c;
+        const float cz = table.aCurlZ[b] * c;
+
+        // (1, 0, s, 0) * curl, splay goes first in the parent's frame
+        const float qw = cw - s * cy;
+        const float qx = cx + s * cz;
+        const float qy = cy + s * cw;
+        const float qz = cz - s * cx;
+
+        const float inv = 1 / std::sqrt(qw * qw + qx * qx + qy * qy + qz * qz);
+        w[b] = qw * inv;
+        x[b] = qx * inv;
+        y[b] = qy * inv;
+        z[b] = qz * inv;
+    }
+
+    for (uint32_t b = 0; b < k_nBones; b++) {
+        bones[b].position = table.aPosition[b];
+        bones[b].orientation = { w[b], x[b], y[b], z[b] };
+    }
+
+    // aux bones are the last joint of each finger seen from the wrist, the wrist itself sits at the root
+    for (size_t f = 0; f < k_nFingers; f++) {
+        hvr::math::vec3f pos;
+        hvr::math::quatf rot = { 1, 0, 0, 0 };
+        for (uint8_t i = 0; i < table.aChainLength[f]; i++) {
+            const uint32_t b = table.aChain[f][i];
+            const auto& p = table.aPosition[b].v;
+            pos += Rotate(rot, { p[0], p[1], p[2] });
+            rot = rot * hvr::math::quatf { w[b], x[b], y[b], z[b] };
+        }
+
+        auto& aux = bones[k_nAux0 + f];
+        aux.position = { { pos.x, pos.y, pos.z, 1 } };
+        aux.orientation = { rot.w, rot.x, rot.y, rot.z };
+    }
+}
+
+}
+
+void HandSkeleton::Create(const vr::PropertyContainerHandle_t container, const DeviceRole role)
+{
+    m_bRight = role == DeviceRole::Right;
+
+    vr::VRInputComponentHandle_t handle = vr::k_ulInvalidInputComponentHandle;
+    vr::VRDriverInput()->CreateSkeletonComponent(container,
+        m_bRight ? "/input/skeleton/right" : "/input/skeleton/left",
+        m_bRight ? "/skeleton/hand/right" : "/skeleton/hand/left",
+        "/pose/raw", vr::VRSkeletalTracking_Partial, nullptr, 0, &handle);
+
+    m_bInvalid = true;
+    m_handle = handle;
+}
+
+void HandSkeleton::Update(const HeaderStatus id, const hvr::net::ByteView body)
+{
+    if (id != HeaderStatus::Client_UpdateDevice)
+        return;
+
+    const auto handle = m_handle.load();
+    if (handle == vr::k_ulInvalidInputComponentHandle)
+        return;
+
+    const DevicePacketView desc(body.Tail(sizeof(sDeviceNetPacket)));
+    if (!desc.Valid())
+        return;
+
+    std::array<float, k_nFingers * 2> values;
+    for (size_t i = 0; i < k_nFingers; i++) {
+        const float curl = desc.FloatState(InputFloat_ThumbCurl + i);
+        const float splay = desc.FloatState(InputFloat_ThumbSplay + i);
+        values[i] = std::isfinite(curl) ? std::clamp(curl, 0.f, 1.f) : 0.f;
+        values[k_nFingers + i] = std::isfinite(splay) ? std::clamp(splay, -1.f, 1.f) : 0.f;
+    }
+
+    // a hand at rest sends the same values over and over
+    if (!m_bInvalid.exchange(false) && values == m_aLast)
+        return;
+    m_aLast = values;
+
+    // the extra entry is for bones no finger drives
+    std::array<float, k_nFingers + 1> curl = {};
+    std::array<float, k_nFingers + 1> splay = {};
+    std::copy_n(values.begin(), k_nFingers, curl.begin());
+    std::copy_n(values.begin() + k_nFingers, k_nFingers, splay.begin());
+
+    ExpandBones(BoneTable(m_bRight), curl, splay, m_aBones);
+
+    // we only know one hand, it's the same with or without the controller
+    vr::VRDriverInput()->UpdateSkeletonComponent(handle, vr::VRSkeletalMotionRange_WithController, m_aBones.data(), k_nBones);
+    vr::VRDriverInput()->UpdateSkeletonComponent(handle, vr::VRSkeletalMotionRange_WithoutController, m_aBones.data(), k_nBones);
+}
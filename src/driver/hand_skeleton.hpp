@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <array>
+#include <atomic>
+
+#include "common.hpp"
+#include "openvr_driver.h"
+
+// Skeletal input for one hand. Clients only send a curl and a splay per finger (see InputFloat),
+// the 31 bone transforms get expanded from those here against a bone table built once per hand.
+// Created in Activate, updates come in on the connection's strand.
+class HandSkeleton {
+public:
+    // the OpenVR hand skeleton, root and wrist, 4 thumb bones, 5 per finger and 5 aux bones
+    static constexpr uint32_t k_nBones = 31;
+    static constexpr size_t k_nFingers = 5;
+
+    void Create(const vr::PropertyContainerHandle_t container, const DeviceRole role);
+
+    // Deactivate, the component is gone
+    void Clear()
+    {
+        m_handle = vr::k_ulInvalidInputComponentHandle;
+    }
+
+    // the next update sends the skeleton even if nothing moved
+    void Invalidate()
+    {
+        m_bInvalid = true;
+    }
+
+    // only full updates carry curls and splays, everything else is ignored
+    void Update(const HeaderStatus id, const hvr::net::ByteView body);
+
+private:
+    bool m_bRight = false;
+    std::atomic<vr::VRInputComponentHandle_t> m_handle { vr::k_ulInvalidInputComponentHandle };
+    std::atomic<bool> m_bInvalid { true };
+
+    // curls then splays, as they were last sent
+    std::array<float, k_nFingers * 2> m_aLast = {};
+    std::array<vr::VRBoneTransform_t, k_nBones> m_aBones = {};
+};
@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include "input_mapper.hpp"
+
+#include "driverlog.h"
+
+void InputMapper::AddBoolean(const vr::VRInputComponentHandle_t handle, const uint8_t bit)
+{
+    sBinding binding;
+    binding.handle = handle;
+    binding.nIndex = bit;
+    Add(binding);
+}
+
+void InputMapper::AddScalar(const vr::VRInputComponentHandle_t handle, const uint8_t index)
+{
+    sBinding binding;
+    binding.handle = handle;
+    binding.bScalar = true;
+    binding.nIndex = index;
+    Add(binding);
+}
+
+void InputMapper::Add(const sBinding& binding)
+{
+    const size_t range = binding.bScalar ? sizeof(sDeviceNetPacket::aFloatStates) / sizeof(float) : 16;
+    if (binding.nIndex >= range) {
+        DriverLog("Input binding out of range: %u", binding.nIndex);
+        return;
+    }
+
+    std::lock_guard lock(m_mutex);
+    if (m_nBindings == m_aBindings.size()) {
+        DriverLog("Too many input bindings, dropping one");
+        return;
+    }
+    m_aBindings[m_nBindings++] = binding;
+}
+
+void InputMapper::Clear()
+{
+    std::lock_guard lock(m_mutex);
+    m_nBindings = 0;
+    // whatever gets bound next starts out knowing nothing, the next update sends all of it
+    m_bInvalid = true;
+}
+
+void InputMapper::Update(const HeaderStatus id, const hvr::net::ByteView body, const double time_offset, const sSkippedButtons& skipped)
+{
+    if (id != HeaderStatus::Client_UpdateDevice)
+        return;
+
+    const DevicePacketView desc(body.Tail(sizeof(sDeviceNetPacket)));
+    if (!desc.Valid())
+        return;
+
+    std::lock_guard lock(m_mutex);
+    const bool all = m_bInvalid.exchange(false);
+    const auto bools = desc.BoolStates();
+
+    for (size_t i = 0; i < m_nBindings; i++) {
+        auto& binding = m_aBindings[i];
+        if (binding.bScalar) {
+            const float value = desc.FloatState(binding.nIndex);
+            if (!all && value == binding.fLast)
+                continue;
+            binding.fLast = value;
+            vr::VRDriverInput()->UpdateScalarComponent(binding.handle, value, time_offset);
+            continue;
+        }
+
+        const bool value = bools[binding.nIndex];
+        const bool last = binding.fLast != 0;
+        const uint16_t mask = static_cast<uint16_t>(1U << binding.nIndex);
+        // pressed and released again (or the other way round) in updates we never saw, that goes out first
+        const bool between = (value ? skipped.nUp : skipped.nDown) & mask;
+        if (between && value == last)
+            vr::VRDriverInput()->UpdateBooleanComponent(binding.handle, !value, time_offset);
+        else if (!all && value == last)
+            continue;
+        binding.fLast = value ? 1.f : 0.f;
+
+        vr::VRDriverInput()->UpdateBooleanComponent(binding.handle, value, time_offset);
+    }
+}
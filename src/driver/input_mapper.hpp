@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <mutex>
+
+#include "common.hpp"
+#include "openvr_driver.h"
+
+// Buttons of full updates that got replaced in the device's mailbox before the device saw them, as bits of bBoolStates.
+// Down is every button that was down in one of them, up every one that was up
+struct sSkippedButtons {
+    uint16_t nDown = 0;
+    uint16_t nUp = 0;
+};
+
+// Maps bBoolStates and aFloatStates of incoming updates onto a device's input components.
+// Only values that changed since the last update go to vrserver, most packets don't touch a single button.
+// Bindings are added in Activate and cleared in Deactivate, updates come in on the connection's strand,
+// so the bindings are behind a lock. Nothing else contends for it, the strand only ever waits on a re-activate.
+class InputMapper {
+public:
+    static constexpr size_t k_nMaxBindings = 16;
+
+    // bit of bBoolStates
+    void AddBoolean(const vr::VRInputComponentHandle_t handle, const uint8_t bit);
+
+    // index into aFloatStates
+    void AddScalar(const vr::VRInputComponentHandle_t handle, const uint8_t index);
+
+    // Deactivate, the handles are gone
+    void Clear();
+
+    // time_offset is the pose's poseTimeOffset, so inputs and pose line up.
+    // Only full updates carry inputs, everything else is ignored.
+    // A button that went the other way in skipped and back gets both changes sent, a click between two drains stays a click
+    void Update(const HeaderStatus id, const hvr::net::ByteView body, const double time_offset, const sSkippedButtons& skipped);
+
+    // the next update sends everything, whatever vrserver had is from someone else
+    void Invalidate()
+    {
+        m_bInvalid = true;
+    }
+
+private:
+    struct sBinding {
+        vr::VRInputComponentHandle_t handle = vr::k_ulInvalidInputComponentHandle;
+        bool bScalar = false;
+        uint8_t nIndex = 0;
+        float fLast = 0;
+    };
+
+    void Add(const sBinding& binding);
+
+    std::mutex m_mutex;
+    std::array<sBinding, k_nMaxBindings> m_aBindings;
+    size_t m_nBindings = 0;
+    std::atomic<bool> m_bInvalid { true };
+};
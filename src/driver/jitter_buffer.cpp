@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include "jitter_buffer.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "hvr_math.hpp"
+
+void JitterBuffer::Configure(const sJitterSettings& settings)
+{
+    m_settings = settings;
+    m_fDelay = settings.fMinDelay;
+}
+
+void JitterBuffer::Push(const sPoseSample& sample)
+{
+    // out of order or a repeat, the ring has to stay sorted
+    if (m_nCount != 0 && static_cast<int64_t>(sample.nTimeUs - At(0).nTimeUs) <= 0)
+        return;
+
+    // how long it took to get here, only the changes matter so clock offsets cancel out
+    const int64_t transit = static_cast<int64_t>(sample.nArrivalUs - sample.nTimeUs);
+    if (transit != 0) {
+        if (m_nCount != 0) {
+            const double change = std::abs(transit - m_nLastTransit) / 1000000.0;
+            m_fJitter += (change - m_fJitter) / 16.0;
+        }
+    } else if (m_nCount != 0) {
+        // No capture time, the sample is stamped with its arrival and the transit is always 0.
+        // Same idea on the spacing instead: how far it strays from the interval the producer usually sends at
+        const double spacing = static_cast<int64_t>(sample.nArrivalUs - m_nLastArrivalUs) / 1000000.0;
+        if (m_fInterval > 0) {
+            m_fJitter += (std::abs(spacing - m_fInterval) - m_fJitter) / 16.0;
+            m_fInterval += (spacing - m_fInterval) / 16.0;
+        } else {
+            m_fInterval = spacing;
+        }
+    }
+    m_nLastTransit = transit;
+    m_nLastArrivalUs = sample.nArrivalUs;
+
+    // up right away, down slowly, a single quiet stretch shouldn't throw away the margin
+    const double target = std::clamp(m_fJitter * m_settings.fJitterScale, m_settings.fMinDelay, m_settings.fMaxDelay);
+    if (target > m_fDelay)
+        m_fDelay = target;
+    else
+        m_fDelay += (target - m_fDelay) / 64.0;
+
+    m_aHistory[m_nNext] = sample;
+    m_nNext = (m_nNext + 1) % k_nHistory;
+    m_nCount = std::min(m_nCount + 1, k_nHistory);
+}
+
+bool JitterBuffer::Sample(const uint64_t now, sPoseSample& out) const
+{
+    if (m_nCount == 0)
+        return false;
+
+    const uint64_t playout = now - static_cast<uint64_t>(m_fDelay * 1000000.0);
+    if (static_cast<int64_t>(playout - At(0).nTimeUs) > 0)
+        return false;
+
+    // the newest sample at or before the playout time, and the one after it
+    size_t age = 1;
+    while (age < m_nCount && static_cast<int64_t>(At(age).nTimeUs - playout) > 0) {
+        age++;
+    }
+    if (age == m_nCount) {
+        // everything we have is newer, still filling up
+        out = At(m_nCount - 1);
+        out.pose.poseTimeOffset = static_cast<int64_t>(out.nTimeUs - now) / 1000000.0;
+        return true;
+    }
+
+    const auto& a = At(age);
+    const auto& b = At(age - 1);
+    const double t = static_cast<double>(playout - a.nTimeUs) / static_cast<double>(b.nTimeUs - a.nTimeUs);
+
+    out = b;
+    out.nTimeUs = playout;
+    for (int i = 0; i < 3; i++) {
+        out.pose.vecPosition[i] = a.pose.vecPosition[i] + (b.pose.vecPosition[i] - a.pose.vecPosition[i]) * t;
+        out.pose.vecVelocity[i] = a.pose.vecVelocity[i] + (b.pose.vecVelocity[i] - a.pose.vecVelocity[i]) * t;
+        out.pose.vecAngularVelocity[i] = a.pose.vecAngularVelocity[i] + (b.pose.vecAngularVelocity[i] - a.pose.vecAngularVelocity[i]) * t;
+    }
+
+    const hvr::math::quatd qa = { a.pose.qRotation.w, a.pose.qRotation.x, a.pose.qRotation.y, a.pose.qRotation.z };
+    const hvr::math::quatd qb = { b.pose.qRotation.w, b.pose.qRotation.x, b.pose.qRotation.y, b.pose.qRotation.z };
+    const auto rot = hvr::math::slerp(qa, qb, t);
+    out.pose.qRotation = { rot.w, rot.x, rot.y, rot.z };
+
+    out.pose.poseTimeOffset = -m_fDelay;
+    return true;
+}
+
+void JitterBuffer::Reset()
+{
+    m_nNext = 0;
+    m_nCount = 0;
+    m_fJitter = 0;
+    m_fInterval = 0;
+    m_fDelay = m_settings.fMinDelay;
+}
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <array>
+
+#include "pose_slot.hpp"
+
+struct sJitterSettings {
+    // off sends poses out as they come in
+    bool bEnabled = false;
+    // the playout delay follows the measured jitter, within these bounds
+    double fMinDelay = 0.005;
+    double fMaxDelay = 0.1;
+    // playout delay in multiples of the jitter, more is smoother and later
+    double fJitterScale = 3.0;
+};
+
+// Smooths out bursty producers: poses are kept in a ring by capture time and played back a little late,
+// interpolated between the two samples around the playout time, at whatever cadence the publisher runs.
+// The delay grows right away when the jitter goes up and creeps back down when it settles.
+// Only touched by the publisher thread.
+class JitterBuffer {
+public:
+    static constexpr size_t k_nHistory = 32;
+
+    void Configure(const sJitterSettings& settings);
+
+    void Push(const sPoseSample& sample);
+
+    // the pose at now minus the playout delay, with nTimeUs set to that time.
+    // false if playout ran past the newest sample, or there isn't anything to play yet
+    bool Sample(const uint64_t now, sPoseSample& out) const;
+
+    double PlayoutDelay() const
+    {
+        return m_fDelay;
+    }
+
+    void Reset();
+
+private:
+    const sPoseSample& At(const size_t age) const
+    {
+        return m_aHistory[(m_nNext + k_nHistory - 1 - age) % k_nHistory];
+    }
+
+    sJitterSettings m_settings;
+
+    // oldest gets overwritten, At(0) is the newest
+    std::array<sPoseSample, k_nHistory> m_aHistory = {};
+    size_t m_nNext = 0;
+    size_t m_nCount = 0;
+
+    // interarrival jitter like rtp does it (rfc 3550), in seconds
+    double m_fJitter = 0;
+    int64_t m_nLastTransit = 0;
+    // for producers without a capture time, the usual spacing between samples in seconds
+    double m_fInterval = 0;
+    uint64_t m_nLastArrivalUs = 0;
+    double m_fDelay = 0;
+};
@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include "pose_decode.hpp"
+
+#include <algorithm>
+
+// anything older than this is a client with a broken clock, not a late packet
+static constexpr double k_fMaxCaptureAge = 0.5;
+
+static bool DecodeFullPose(const hvr::net::ByteView body, vr::DriverPose_t& pose)
+{
+    // the rest of the packet (inputs, reserved) is never touched here
+    const DevicePacketView desc(body.Tail(sizeof(sDeviceNetPacket)));
+    if (!desc.Valid())
+        return false;
+
+    const auto pos = desc.Pos();
+    const auto vel = desc.Vel();
+    const auto rot = desc.Rot();
+    const auto ang_vel = desc.AngVel();
+
+    pose.vecPosition[0] = pos.x;
+    pose.vecPosition[1] = pos.y;
+    pose.vecPosition[2] = pos.z;
+
+    pose.vecVelocity[0] = vel.x;
+    pose.vecVelocity[1] = vel.y;
+    pose.vecVelocity[2] = vel.z;
+
+    pose.qRotation.w = rot.w;
+    pose.qRotation.x = rot.x;
+    pose.qRotation.y = rot.y;
+    pose.qRotation.z = rot.z;
+
+    pose.vecAngularVelocity[0] = ang_vel.x;
+    pose.vecAngularVelocity[1] = ang_vel.y;
+    pose.vecAngularVelocity[2] = ang_vel.z;
+
+    pose.poseTimeOffset = CaptureTimeOffset(desc.CaptureTime());
+
+    return true;
+}
+
+static bool DecodeCompactPose(const hvr::net::ByteView body, vr::DriverPose_t& pose)
+{
+    hvr::compact::sCompactBody compact;
+    if (!hvr::compact::ParseCompactBody(body, compact))
+        return false;
+
+    pose.vecPosition[0] = compact.vPos.x;
+    pose.vecPosition[1] = compact.vPos.y;
+    pose.vecPosition[2] = compact.vPos.z;
+
+    pose.vecVelocity[0] = compact.vVel.x;
+    pose.vecVelocity[1] = compact.vVel.y;
+    pose.vecVelocity[2] = compact.vVel.z;
+
+    pose.qRotation.w = compact.qRot.w;
+    pose.qRotation.x = compact.qRot.x;
+    pose.qRotation.y = compact.qRot.y;
+    pose.qRotation.z = compact.qRot.z;
+
+    pose.vecAngularVelocity[0] = compact.vAngVel.x;
+    pose.vecAngularVelocity[1] = compact.vAngVel.y;
+    pose.vecAngularVelocity[2] = compact.vAngVel.z;
+
+    pose.poseTimeOffset = CaptureTimeOffset(compact.nCaptureTimeUs);
+
+    return true;
+}
+
+bool DecodeDevicePose(const HeaderStatus id, const hvr::net::ByteView body, vr::DriverPose_t& pose)
+{
+    switch (id) {
+    case HeaderStatus::Client_UpdateDevice:
+        return DecodeFullPose(body, pose);
+
+    case HeaderStatus::Client_UpdateDeviceCompact:
+        return DecodeCompactPose(body, pose);
+
+    default:
+        return false;
+    }
+}
+
+double CaptureTimeOffset(const uint64_t capture_time)
+{
+    if (capture_time == 0)
+        return 0;
+
+    // negative, the pose is from the past. A capture time slightly ahead of us is the
+    // clock estimate being a bit off, that's just now
+    const double age = static_cast<int64_t>(hvr::clock::NowMicros() - capture_time) / 1000000.0;
+    return -std::clamp(age, 0.0, k_fMaxCaptureAge);
+}
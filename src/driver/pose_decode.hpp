@@ -0,0 +1,14 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include "common.hpp"
+#include "openvr_driver.h"
+
+// Decodes any of the device update bodies straight into a DriverPose_t, reading in place.
+// Only the tracking fields and poseTimeOffset are touched, returns false if body isn't a valid pose update.
+bool DecodeDevicePose(const HeaderStatus id, const hvr::net::ByteView body, vr::DriverPose_t& pose);
+
+// Seconds between now and a capture time in server time, for poseTimeOffset and input updates
+// coming from the same packet. 0 if the client didn't stamp it.
+double CaptureTimeOffset(const uint64_t capture_time);
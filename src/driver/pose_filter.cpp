@@ -0,0 +1,124 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include "pose_filter.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// a gap this long and the old state isn't worth anything anymore
+static constexpr double k_fMaxGap = 0.5;
+
+// one euro smoothing factor for a cutoff in Hz
+static double Alpha(const double cutoff, const double dt)
+{
+    const double tau = 1.0 / (2.0 * 3.14159265358979323846 * cutoff);
+    return 1.0 / (1.0 + tau / dt);
+}
+
+void PoseFilter::Configure(const sFilterSettings& settings)
+{
+    m_settings = settings;
+    Reset();
+}
+
+void PoseFilter::Filter(sPoseSample& sample)
+{
+    if (m_settings.type == PoseFilterType::Passthrough)
+        return;
+
+    auto& s = m_state;
+    const double dt = static_cast<int64_t>(sample.nTimeUs - s.nLastUs) / 1000000.0;
+    if (s.bPrimed && dt <= 0)
+        return;
+
+    if (!s.bPrimed || dt > k_fMaxGap) {
+        s = {};
+        for (int i = 0; i < 3; i++) {
+            s.aPos[i] = sample.pose.vecPosition[i];
+            s.aVel[i] = sample.pose.vecVelocity[i];
+            s.aCov[i][0] = m_settings.fMeasurementNoise * m_settings.fMeasurementNoise;
+            s.aCov[i][2] = m_settings.fAccelNoise * m_settings.fAccelNoise;
+        }
+        const auto& q = sample.pose.qRotation;
+        s.qRot = { q.w, q.x, q.y, q.z };
+        s.nLastUs = sample.nTimeUs;
+        s.bPrimed = true;
+        return;
+    }
+    s.nLastUs = sample.nTimeUs;
+
+    if (m_settings.type == PoseFilterType::OneEuro)
+        OneEuro(sample, dt);
+    else
+        Kalman(sample, dt);
+}
+
+void PoseFilter::OneEuro(sPoseSample& sample, const double dt)
+{
+    auto& s = m_state;
+    const double alpha_d = Alpha(m_settings.fDerivativeCutoff, dt);
+
+    for (int i = 0; i < 3; i++) {
+        const double x = sample.pose.vecPosition[i];
+        s.aPosSpeed[i] += alpha_d * ((x - s.aPos[i]) / dt - s.aPosSpeed[i]);
+
+        const double cutoff = m_settings.fMinCutoff + m_settings.fBeta * std::abs(s.aPosSpeed[i]);
+        s.aPos[i] += Alpha(cutoff, dt) * (x - s.aPos[i]);
+        sample.pose.vecPosition[i] = s.aPos[i];
+    }
+
+    // same thing for the rotation, with the angle to the last filtered one as the distance
+    const auto& q = sample.pose.qRotation;
+    const hvr::math::quatd rot = { q.w, q.x, q.y, q.z };
+    const double dot = std::min(1.0, std::abs(rot.w * s.qRot.w + rot.x * s.qRot.x + rot.y * s.qRot.y + rot.z * s.qRot.z));
+    const double angle = 2.0 * std::acos(dot);
+    s.fRotSpeed += alpha_d * (angle / dt - s.fRotSpeed);
+
+    const double cutoff = m_settings.fMinCutoff + m_settings.fBeta * s.fRotSpeed;
+    s.qRot = hvr::math::slerp(s.qRot, rot, Alpha(cutoff, dt));
+    sample.pose.qRotation = { s.qRot.w, s.qRot.x, s.qRot.y, s.qRot.z };
+}
+
+void PoseFilter::Kalman(sPoseSample& sample, const double dt)
+{
+    auto& s = m_state;
+    const double q = m_settings.fAccelNoise * m_settings.fAccelNoise;
+    const double r = m_settings.fMeasurementNoise * m_settings.fMeasurementNoise;
+
+    // producers that don't send velocities get ours, the predictor needs them
+    const bool has_velocity = sample.pose.vecVelocity[0] != 0 || sample.pose.vecVelocity[1] != 0 || sample.pose.vecVelocity[2] != 0;
+
+    // the axes don't talk to each other, three 2 state filters instead of one 6 state one
+    for (int i = 0; i < 3; i++) {
+        double& x = s.aPos[i];
+        double& v = s.aVel[i];
+        double& p00 = s.aCov[i][0];
+        double& p01 = s.aCov[i][1];
+        double& p11 = s.aCov[i][2];
+
+        // predict, white noise acceleration
+        x += v * dt;
+        p00 += dt * (2 * p01 + dt * p11) + q * dt * dt * dt * dt / 4;
+        p01 += dt * p11 + q * dt * dt * dt / 2;
+        p11 += q * dt * dt;
+
+        // update with the measured position
+        const double y = sample.pose.vecPosition[i] - x;
+        const double k0 = p00 / (p00 + r);
+        const double k1 = p01 / (p00 + r);
+        x += k0 * y;
+        v += k1 * y;
+        p11 -= k1 * p01;
+        p01 -= k0 * p01;
+        p00 -= k0 * p00;
+
+        sample.pose.vecPosition[i] = x;
+        if (!has_velocity)
+            sample.pose.vecVelocity[i] = v;
+    }
+}
+
+void PoseFilter::Reset()
+{
+    m_state = {};
+}
@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include "hvr_math.hpp"
+#include "pose_slot.hpp"
+
+enum class PoseFilterType : uint8_t {
+    Passthrough,
+    // adaptive low-pass, smooth when slow and responsive when fast
+    OneEuro,
+    // constant velocity kalman filter on the position, rotation passes through
+    Kalman,
+};
+
+struct sFilterSettings {
+    PoseFilterType type = PoseFilterType::Passthrough;
+
+    // one euro, cutoffs in Hz. A lower min cutoff is less jitter at rest, a higher beta is less lag in motion
+    double fMinCutoff = 1.0;
+    double fBeta = 0.5;
+    double fDerivativeCutoff = 1.0;
+
+    // kalman, how hard the device can accelerate in m/s^2 and how noisy a position is in m
+    double fAccelNoise = 5.0;
+    double fMeasurementNoise = 0.005;
+};
+
+// Smooths the poses of one device before the jitter buffer and the predictor see them. Gets every pose that made it
+// to the device, in the order they came in, not just the ones that happened to be newest when the publisher ran.
+// The whole state is one flat struct, no allocation and nothing to chase.
+// Only touched by the publisher thread.
+class PoseFilter {
+public:
+    void Configure(const sFilterSettings& settings);
+
+    // in place, uses the capture times to get dt
+    void Filter(sPoseSample& sample);
+
+    void Reset();
+
+private:
+    void OneEuro(sPoseSample& sample, const double dt);
+
+    void Kalman(sPoseSample& sample, const double dt);
+
+    sFilterSettings m_settings;
+
+    struct sState {
+        // filtered position, and for one euro its filtered per axis speed
+        double aPos[3];
+        double aPosSpeed[3];
+        // kalman velocity and covariance per axis, { pos pos, pos vel, vel vel }
+        double aVel[3];
+        double aCov[3][3];
+        // one euro rotation and its filtered angular speed
+        hvr::math::quatd qRot;
+        double fRotSpeed;
+
+        uint64_t nLastUs;
+        bool bPrimed;
+    };
+
+    sState m_state = {};
+};
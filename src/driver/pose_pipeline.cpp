@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include "pose_pipeline.hpp"
+
+#include "clock_sync.hpp"
+
+// just the connected state, no pose. Connected but without a sample yet is uninitialized, not a valid pose at the origin
+static vr::DriverPose_t StatePose(const bool connected)
+{
+    vr::DriverPose_t pose = { 0 };
+    pose.qWorldFromDriverRotation.w = 1.f;
+    pose.qDriverFromHeadRotation.w = 1.f;
+    pose.qRotation.w = 1.f;
+    pose.poseIsValid = !connected;
+    pose.deviceIsConnected = connected;
+    pose.result = connected ? vr::TrackingResult_Uninitialized : vr::TrackingResult_Running_OK;
+    return pose;
+}
+
+void PosePipeline::Configure(const sPoseSettings& settings, PoseSlot& slot)
+{
+    m_filter.Configure(settings.filter);
+    m_bJitter = settings.jitter.bEnabled;
+    m_jitter.Configure(settings.jitter);
+    m_predictor.Configure(settings.prediction);
+    // the filter's state has to see every sample, the newest one alone would skip whatever came in between publishes
+    m_bHistory = m_bJitter || settings.filter.type != PoseFilterType::Passthrough;
+    slot.KeepHistory(m_bHistory);
+}
+
+bool PosePipeline::NextSample(const uint64_t now, PoseSlot& slot, sPoseSample& sample)
+{
+    if (!m_bHistory)
+        return slot.Take(sample);
+
+    bool fresh = false;
+    while (slot.TakeHistory(sample)) {
+        Accept(sample);
+        fresh = true;
+    }
+
+    // The slot has the newest one too. It's only new to us if the history was full when it came in,
+    // otherwise it's just cleared so it doesn't hold on to anything stale
+    sPoseSample newest;
+    if (slot.Take(newest) && (!fresh || newest.nArrivalUs > sample.nArrivalUs)) {
+        sample = newest;
+        Accept(sample);
+        fresh = true;
+    }
+
+    if (!m_bJitter)
+        return fresh;
+
+    // interpolated at the steady playout time, the predictor takes over if that runs dry
+    return m_jitter.Sample(now, sample);
+}
+
+void PosePipeline::Accept(sPoseSample& sample)
+{
+    m_filter.Filter(sample);
+    if (m_bJitter)
+        m_jitter.Push(sample);
+}
+
+void PosePipeline::Publish(const vr::TrackedDeviceIndex_t index, const bool connected, PoseSlot& slot)
+{
+    // not activated yet, or already gone
+    if (index == vr::k_unTrackedDeviceIndexInvalid)
+        return;
+
+    const uint64_t now = hvr::clock::NowMicros();
+    sPoseSample sample;
+    const bool fresh = NextSample(now, slot, sample);
+
+    vr::DriverPose_t pose;
+    if (!connected) {
+        m_filter.Reset();
+        m_predictor.Reset();
+        m_jitter.Reset();
+        if (!m_bPublishedConnected)
+            return;
+        pose = StatePose(false);
+    } else if (fresh) {
+        pose = m_predictor.OnSample(sample, now);
+    } else if (!m_bPublishedConnected) {
+        // everything got reset when it went away, so there's nothing to show until its first sample
+        pose = StatePose(true);
+    } else if (!m_predictor.Predict(now, pose)) {
+        return;
+    }
+    m_bPublishedConnected = connected;
+
+    vr::VRServerDriverHost()->TrackedDevicePoseUpdated(index, pose, sizeof(pose));
+}
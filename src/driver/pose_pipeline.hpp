@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include "jitter_buffer.hpp"
+#include "pose_filter.hpp"
+#include "pose_predictor.hpp"
+#include "pose_slot.hpp"
+
+// per device type tunables for everything between decode and vrserver
+struct sPoseSettings {
+    sFilterSettings filter;
+    sPredictionSettings prediction;
+    sJitterSettings jitter;
+};
+
+// Everything that happens to a device's poses between its slot and vrserver, only the publisher thread touches it
+class PosePipeline {
+public:
+    // before the device is added anywhere the publisher can see it, sets the slot up to match
+    void Configure(const sPoseSettings& settings, PoseSlot& slot);
+
+    // Sends the newest pose to vrserver, or a predicted one if nothing new came in. A device that got turned on or off
+    // without a pose to go with it still gets its connected state updated.
+    void Publish(const vr::TrackedDeviceIndex_t index, const bool connected, PoseSlot& slot);
+
+private:
+    // the next pose to go out, false if nothing new is due
+    bool NextSample(const uint64_t now, PoseSlot& slot, sPoseSample& sample);
+
+    // filters a sample out of the slot in place and hands it to the jitter buffer if there is one
+    void Accept(sPoseSample& sample);
+
+    PoseFilter m_filter;
+    // samples come out of the slot's history instead of only the newest one
+    bool m_bHistory = false;
+    bool m_bJitter = false;
+    JitterBuffer m_jitter;
+    PosePredictor m_predictor;
+    bool m_bPublishedConnected = true;
+};
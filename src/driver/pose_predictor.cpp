@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include "pose_predictor.hpp"
+
+#include <algorithm>
+
+static double Seconds(const uint64_t to, const uint64_t from)
+{
+    return static_cast<int64_t>(to - from) / 1000000.0;
+}
+
+static hvr::math::quatd ToQuat(const vr::HmdQuaternion_t& q)
+{
+    return { q.w, q.x, q.y, q.z };
+}
+
+static vr::HmdQuaternion_t FromQuat(const hvr::math::quatd& q)
+{
+    return { q.w, q.x, q.y, q.z };
+}
+
+// where pose will be dt seconds later, going by its velocities
+static vr::DriverPose_t Extrapolate(const vr::DriverPose_t& pose, const double dt)
+{
+    vr::DriverPose_t out = pose;
+    for (int i = 0; i < 3; i++) {
+        out.vecPosition[i] += pose.vecVelocity[i] * dt;
+    }
+
+    const hvr::math::vec3d turn = {
+        pose.vecAngularVelocity[0] * dt,
+        pose.vecAngularVelocity[1] * dt,
+        pose.vecAngularVelocity[2] * dt,
+    };
+    out.qRotation = FromQuat(hvr::math::normalize(hvr::math::from_rotation_vector(turn) * ToQuat(pose.qRotation)));
+    return out;
+}
+
+void PosePredictor::Configure(const sPredictionSettings& settings)
+{
+    m_settings = settings;
+}
+
+vr::DriverPose_t PosePredictor::OnSample(const sPoseSample& sample, const uint64_t now)
+{
+    if (m_bPredicted && m_settings.fBlendTime > 0) {
+        // where we told vrserver the device would be by now, against where it really is
+        const auto told = Extrapolate(m_last_out.pose, Seconds(now, m_last_out.nTimeUs));
+        const auto real = Extrapolate(sample.pose, Seconds(now, sample.nTimeUs));
+
+        m_vPosError = {
+            told.vecPosition[0] - real.vecPosition[0],
+            told.vecPosition[1] - real.vecPosition[1],
+            told.vecPosition[2] - real.vecPosition[2],
+        };
+        m_qRotError = hvr::math::normalize(ToQuat(told.qRotation) * hvr::math::conj(ToQuat(real.qRotation)));
+        m_nBlendStart = now;
+        m_bBlending = true;
+    }
+
+    m_last = sample;
+    m_bHasSample = true;
+    m_bPredicted = false;
+    m_bHolding = false;
+
+    vr::DriverPose_t out = sample.pose;
+    out.poseTimeOffset = Seconds(sample.nTimeUs, now);
+    ApplyBlend(out, now);
+
+    m_last_out = { out, sample.nTimeUs };
+    return out;
+}
+
+bool PosePredictor::Predict(const uint64_t now, vr::DriverPose_t& out)
+{
+    if (!m_bHasSample || m_settings.fHorizon <= 0)
+        return false;
+
+    const double age = Seconds(now, m_last.nTimeUs);
+    if (age > m_settings.fHorizon) {
+        if (m_bHolding)
+            return false;
+
+        // out of horizon, stop where we got to instead of drifting off
+        out = Extrapolate(m_last.pose, m_settings.fHorizon);
+        for (int i = 0; i < 3; i++) {
+            out.vecVelocity[i] = 0;
+            out.vecAngularVelocity[i] = 0;
+        }
+        m_bHolding = true;
+    } else {
+        out = Extrapolate(m_last.pose, std::max(age, 0.0));
+    }
+    out.poseTimeOffset = 0;
+    ApplyBlend(out, now);
+
+    m_bPredicted = true;
+    m_last_out = { out, now };
+    return true;
+}
+
+void PosePredictor::Reset()
+{
+    m_bHasSample = false;
+    m_bPredicted = false;
+    m_bHolding = false;
+    m_bBlending = false;
+}
+
+void PosePredictor::ApplyBlend(vr::DriverPose_t& pose, const uint64_t now)
+{
+    if (!m_bBlending)
+        return;
+
+    const double weight = 1.0 - Seconds(now, m_nBlendStart) / m_settings.fBlendTime;
+    if (weight <= 0) {
+        m_bBlending = false;
+        return;
+    }
+
+    pose.vecPosition[0] += m_vPosError.x * weight;
+    pose.vecPosition[1] += m_vPosError.y * weight;
+    pose.vecPosition[2] += m_vPosError.z * weight;
+
+    const auto correction = hvr::math::slerp(hvr::math::quatd { 1, 0, 0, 0 }, m_qRotError, weight);
+    pose.qRotation = FromQuat(hvr::math::normalize(correction * ToQuat(pose.qRotation)));
+}
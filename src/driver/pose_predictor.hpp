@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include "hvr_math.hpp"
+#include "pose_slot.hpp"
+
+struct sPredictionSettings {
+    // how far past the last sample poses keep getting extrapolated, 0 turns prediction off
+    double fHorizon = 0;
+    // how long it takes to fade out the difference between the prediction and the real sample
+    double fBlendTime = 0.03;
+};
+
+// Dead reckoning for one device. While nothing new comes in the last sample gets extrapolated with its velocities,
+// once the real one shows up the difference is blended away instead of jumping to it.
+// Only touched by the publisher thread.
+class PosePredictor {
+public:
+    void Configure(const sPredictionSettings& settings);
+
+    // a real sample came in, returns what to publish
+    vr::DriverPose_t OnSample(const sPoseSample& sample, const uint64_t now);
+
+    // nothing new came in, false if there is nothing worth publishing
+    bool Predict(const uint64_t now, vr::DriverPose_t& out);
+
+    // the device went away, the next sample starts over
+    void Reset();
+
+private:
+    void ApplyBlend(vr::DriverPose_t& pose, const uint64_t now);
+
+    sPredictionSettings m_settings;
+
+    sPoseSample m_last;
+    bool m_bHasSample = false;
+    // published something extrapolated since the last sample
+    bool m_bPredicted = false;
+    // ran past the horizon, the final pose is already out
+    bool m_bHolding = false;
+
+    // what we told vrserver last, and the time it was for
+    sPoseSample m_last_out;
+
+    bool m_bBlending = false;
+    uint64_t m_nBlendStart = 0;
+    hvr::math::vec3d m_vPosError;
+    hvr::math::quatd m_qRotError = { 1, 0, 0, 0 };
+};
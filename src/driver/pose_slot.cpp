@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include "pose_slot.hpp"
+
+#include <cmath>
+
+void PoseSlot::Write(const vr::DriverPose_t& pose, const uint64_t now)
+{
+    auto& sample = m_aBuffers[m_nBack];
+    sample.pose = pose;
+    sample.nTimeUs = now + static_cast<int64_t>(std::llround(pose.poseTimeOffset * 1000000.0));
+    sample.nArrivalUs = now;
+
+    if (m_bKeepHistory)
+        m_history.Push(sample);
+
+    // hand the filled buffer over and carry on with whatever was in the middle
+    m_nBack = m_nMiddle.exchange(m_nBack | k_nFresh, std::memory_order_acq_rel) & k_nIndexMask;
+}
+
+bool PoseSlot::Take(sPoseSample& sample)
+{
+    if (!(m_nMiddle.load(std::memory_order_relaxed) & k_nFresh))
+        return false;
+
+    m_nFront = m_nMiddle.exchange(m_nFront, std::memory_order_acq_rel) & k_nIndexMask;
+    sample = m_aBuffers[m_nFront];
+    return true;
+}
+
+bool PoseSlot::TakeHistory(sPoseSample& sample)
+{
+    const auto* front = m_history.Front();
+    if (!front)
+        return false;
+
+    sample = *front;
+    m_history.Pop();
+    return true;
+}
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "openvr_driver.h"
+#include "shm_ring.hpp"
+
+struct sPoseSample {
+    vr::DriverPose_t pose = { 0 };
+    // server time the pose is valid for, poseTimeOffset is relative to when it was decoded and gets redone on publish
+    uint64_t nTimeUs = 0;
+    // when it was decoded
+    uint64_t nArrivalUs = 0;
+};
+
+// Latest-pose handoff from the ipc side to the publisher thread, the only one that talks to vrserver.
+// Neither side ever waits: the writer fills its own buffer and swaps it with the middle one,
+// the reader swaps the middle one out if it has something new. Three buffers instead of two,
+// so the writer always has one the reader can't be looking at.
+// One writer (the device's connection strand) and one reader (the publisher) at a time.
+// Devices with a filter or a jitter buffer need every sample, not just the newest, those go through a ring on the side.
+class PoseSlot {
+public:
+    // before the device goes anywhere the writer or the reader can see it
+    void KeepHistory(const bool keep)
+    {
+        m_bKeepHistory = keep;
+    }
+
+    // writer side, now is when pose got decoded
+    void Write(const vr::DriverPose_t& pose, const uint64_t now);
+
+    // reader side, false if nothing new came in since the last Take
+    bool Take(sPoseSample& sample);
+
+    // reader side, every sample in order if KeepHistory is on, false once there's nothing left
+    bool TakeHistory(sPoseSample& sample);
+
+private:
+    static constexpr uint8_t k_nIndexMask = 0x3;
+    static constexpr uint8_t k_nFresh = 0x4;
+
+    std::array<sPoseSample, 3> m_aBuffers = {};
+    // index of the middle buffer, with k_nFresh set if the writer put something in it the reader hasn't seen
+    std::atomic<uint8_t> m_nMiddle { 1 };
+
+    // writer only
+    uint8_t m_nBack = 0;
+
+    // reader only
+    uint8_t m_nFront = 2;
+
+    bool m_bKeepHistory = false;
+    // if the publisher falls this far behind the newest samples get dropped, Take still has the very newest
+    hvr::shm::SpscRing<sPoseSample, 32> m_history;
+};
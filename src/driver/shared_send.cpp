@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include "shared_send.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+
+SharedMessage MakeSharedMessage(const olc::net::message<HeaderStatus>& msg)
+{
+    auto shared = std::make_shared<sSharedMessage>();
+    shared->header = msg.header;
+    shared->header.size = static_cast<uint32_t>(msg.body.size());
+    shared->body = msg.body;
+    return shared;
+}
+
+SharedMessagePool::SharedMessagePool(const size_t count, const size_t body_capacity)
+    : m_nBodyCapacity(body_capacity)
+{
+    m_vBuffers.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        auto msg = std::make_shared<sSharedMessage>();
+        msg->body.reserve(m_nBodyCapacity);
+        m_vBuffers.push_back(std::move(msg));
+    }
+}
+
+std::shared_ptr<sSharedMessage> SharedMessagePool::Acquire()
+{
+    for (size_t i = 0; i < m_vBuffers.size(); i++) {
+        auto& msg = m_vBuffers[m_nNext];
+        m_nNext = (m_nNext + 1) % m_vBuffers.size();
+
+        // only the pool holds it, every write that used it is done
+        if (msg.use_count() == 1) {
+            // the writers dropped their references on the asio thread
+            std::atomic_thread_fence(std::memory_order_acquire);
+            msg->header = {};
+            msg->body.clear();
+            msg->nReplaceKey = 0;
+            return msg;
+        }
+    }
+
+    // everything is still in flight, someone is reading slowly
+    auto msg = std::make_shared<sSharedMessage>();
+    msg->body.reserve(m_nBodyCapacity);
+    return msg;
+}
+
+SharedWriter::SharedWriter(Strand strand, std::shared_ptr<IpcConnection> connection, const size_t max_queued)
+    : m_strand(std::move(strand))
+    , m_connection(std::move(connection))
+    , m_nMaxQueued(std::max<size_t>(max_queued, 1))
+{
+}
+
+void SharedWriter::Send(SharedMessage msg)
+{
+    asio::post(m_strand, [self = shared_from_this(), msg = std::move(msg)]() mutable {
+        // olc closes the socket when a read fails, this is where we find out.
+        // A write still in flight fails on its own and cleans up the queue
+        if (!self->m_connection->Socket().is_open()) {
+            self->m_bConnected = false;
+            return;
+        }
+
+        const bool bWritingMessage = !self->m_qOut.empty();
+        self->Enqueue(std::move(msg));
+        if (!bWritingMessage)
+            self->WriteNext();
+    });
+}
+
+void SharedWriter::Probe()
+{
+    asio::post(m_strand, [self = shared_from_this()]() {
+        if (!self->m_connection->Socket().is_open())
+            self->m_bConnected = false;
+    });
+}
+
+void SharedWriter::Enqueue(SharedMessage msg)
+{
+    // the front is already on its way out, it can't be touched anymore
+    const auto first_waiting = m_qOut.empty() ? m_qOut.end() : m_qOut.begin() + 1;
+
+    if (msg->nReplaceKey != 0) {
+        // a newer update for the same device, the old one isn't worth sending anymore
+        const auto same = std::find_if(first_waiting, m_qOut.end(), [&msg](const SharedMessage& queued) {
+            return queued->nReplaceKey == msg->nReplaceKey;
+        });
+        if (same != m_qOut.end()) {
+            *same = std::move(msg);
+            m_nDropped++;
+            return;
+        }
+
+        if (m_qOut.size() >= m_nMaxQueued) {
+            const auto oldest = std::find_if(first_waiting, m_qOut.end(), [](const SharedMessage& queued) {
+                return queued->nReplaceKey != 0;
+            });
+            if (oldest != m_qOut.end()) {
+                m_qOut.erase(oldest);
+                m_nDropped++;
+            }
+        }
+    }
+
+    // control messages always make it in, even past the cap
+    m_qOut.push_back(std::move(msg));
+    m_nQueued = m_qOut.size();
+}
+
+void SharedWriter::WriteNext()
+{
+    const auto& msg = m_qOut.front();
+    const std::array<asio::const_buffer, 2> buffers = { {
+        asio::buffer(&msg->header, sizeof(msg->header)),
+        asio::buffer(msg->body),
+    } };
+
+    asio::async_write(m_connection->Socket(), buffers,
+        asio::bind_executor(m_strand, [self = shared_from_this()](std::error_code ec, std::size_t length) {
+            if (ec) {
+                // same as olc does, the read side notices and the server cleans up
+                self->m_bConnected = false;
+                self->m_connection->Disconnect();
+                self->m_qOut.clear();
+                self->m_nQueued = 0;
+                return;
+            }
+
+            self->m_qOut.pop_front();
+            self->m_nQueued = self->m_qOut.size();
+            if (!self->m_qOut.empty())
+                self->WriteNext();
+        }));
+}
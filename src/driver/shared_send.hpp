@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "common.hpp"
+
+// An outgoing message serialized once and shared by every connection it goes out to.
+// Nobody touches it anymore once it's been handed to a SharedWriter.
+struct sSharedMessage {
+    olc::net::message_header<HeaderStatus> header;
+    std::vector<uint8_t> body;
+
+    // 0 for control messages, they are never dropped. Anything else may be dropped when the client falls behind,
+    // and a newer message with the same key replaces the one still waiting in the queue
+    uint64_t nReplaceKey = 0;
+};
+
+// one key per message kind and device (or connection, for batches)
+inline uint64_t MakeReplaceKey(const HeaderStatus id, const uint32_t nUniqueID)
+{
+    return (static_cast<uint64_t>(id) + 1) << 32 | nUniqueID;
+}
+
+using SharedMessage = std::shared_ptr<const sSharedMessage>;
+
+// one copy of msg, for the control messages that don't come out of a pool
+SharedMessage MakeSharedMessage(const olc::net::message<HeaderStatus>& msg);
+
+// olc's connection, with the socket in reach for SharedWriter. The server makes every connection it accepts as one of these,
+// olc itself only ever sees the base
+class IpcConnection : public olc::net::connection<HeaderStatus> {
+public:
+    using olc::net::connection<HeaderStatus>::connection;
+
+    inline asio::ip::tcp::socket& Socket()
+    {
+        return m_socket;
+    }
+};
+
+// Recycles shared messages once every writer let go of them, so fan-out doesn't allocate either.
+// Outgoing only, what comes in over tcp is still a fresh olc message per read.
+// Only one thread (or strand) builds messages from a pool, writers just drop their reference when they're done.
+class SharedMessagePool {
+public:
+    SharedMessagePool(const size_t count, const size_t body_capacity);
+
+    // an empty message nobody else holds on to, fill it in and hand it out as a SharedMessage
+    std::shared_ptr<sSharedMessage> Acquire();
+
+private:
+    size_t m_nBodyCapacity;
+    size_t m_nNext = 0;
+    std::vector<std::shared_ptr<sSharedMessage>> m_vBuffers;
+};
+
+// Writes shared messages to a connection with a single gather write each, instead of
+// connection::Send copying every message into the connection's own queue.
+// Once a connection has a writer everything to it has to go through the writer,
+// two write queues on one socket would interleave their messages.
+// The strand has to be on olc's context, that's the thread doing the reads on the same socket.
+//
+// The queue is capped at max_queued messages, a client that stops reading doesn't get to eat all our memory.
+// Past the cap the oldest droppable message goes, control messages are kept no matter what.
+class SharedWriter : public std::enable_shared_from_this<SharedWriter> {
+public:
+    using Strand = asio::strand<asio::io_context::executor_type>;
+
+    SharedWriter(Strand strand, std::shared_ptr<IpcConnection> connection, const size_t max_queued);
+
+    // can be called from any thread, the write gets queued up on the connection's strand
+    void Send(SharedMessage msg);
+
+    // has the strand look at the socket, a client we never write to doesn't find out otherwise
+    void Probe();
+
+    // false once a write failed or the socket was found closed, from any thread
+    inline bool IsConnected() const
+    {
+        return m_bConnected;
+    }
+
+    inline size_t QueueDepth() const
+    {
+        return m_nQueued;
+    }
+
+    // replaced or dropped because the client fell behind
+    inline uint64_t Dropped() const
+    {
+        return m_nDropped;
+    }
+
+    inline const std::shared_ptr<IpcConnection>& GetConnection() const
+    {
+        return m_connection;
+    }
+
+private:
+    void WriteNext();
+
+    void Enqueue(SharedMessage msg);
+
+    Strand m_strand;
+    std::shared_ptr<IpcConnection> m_connection;
+    size_t m_nMaxQueued;
+
+    // only ever touched on the strand, the front is the one being written
+    std::deque<SharedMessage> m_qOut;
+
+    std::atomic<bool> m_bConnected { true };
+    std::atomic<size_t> m_nQueued { 0 };
+    std::atomic<uint64_t> m_nDropped { 0 };
+};
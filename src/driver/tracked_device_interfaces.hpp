@@ -4,18 +4,53 @@
 #define TRACKED_DEVICES_INTERFACES_HPP
 
 #include "common.hpp"
+#include "input_mapper.hpp"
 #include "openvr_driver.h"
+#include "pose_pipeline.hpp"
 #include <string>
+#include <vector>
+
+// an event a device wants to see in hProcessEvent
+struct sEventInterest {
+    enum class Match : uint8_t {
+        // every event of the type
+        Any,
+        // only the ones for the tracked device index in nKey
+        DeviceIndex,
+        // only the ones for the input component handle in nKey, for events that carry one
+        Component,
+    };
+
+    uint32_t nEventType = vr::VREvent_None;
+    Match eMatch = Match::Any;
+    uint64_t nKey = 0;
+};
 
 class IHvrTrackedDevice : public vr::ITrackedDeviceServerDriver {
 
 public:
     virtual const std::string& hGetSerialNumber() = 0;
     virtual DeviceType hGetDeviceType() = 0;
+    virtual DeviceRole hGetDeviceRole() = 0;
 
-    virtual void hProcessEvent(const vr::VREvent_t& vrevent) = 0;
-    virtual void hProcessMsg(olc::net::message<HeaderStatus>& msg) = 0;
+    // true if it left a haptic pulse for hTakeHaptic
+    virtual bool hProcessEvent(const vr::VREvent_t& vrevent) = 0;
+    // What hProcessEvent wants, nothing else reaches it. Asked again whenever the device gets added, removed
+    // or activated, so interests in its own index or components can wait for Activate. One interest per event
+    virtual void hGetEventInterests(std::vector<sEventInterest>& interests) = 0;
+    // the haptic pulse hProcessEvent collected since the last call, false if there is none.
+    // Same thread as hProcessEvent, nUniqueID is left for the caller
+    virtual bool hTakeHaptic(sHapticPulse& pulse) = 0;
+    // body is only valid for the duration of the call. Inputs and the skeleton go to vrserver right here,
+    // the pose is left for hPublish. skipped has the buttons of updates that got coalesced away before this one
+    virtual void hProcessMsg(const HeaderStatus id, const hvr::net::ByteView body, const sSkippedButtons& skipped) = 0;
+    // runs on the publisher thread, hands the newest pose and the connected state to vrserver
+    virtual void hPublish() = 0;
+    // set once, before the device goes anywhere the publisher can see it
+    virtual void hSetPoseSettings(const sPoseSettings& settings) = 0;
 
+    // devices start out on, warm pool devices get turned off before they are added to vrserver
+    // and show up disconnected until a client takes them
     virtual void hTurnOff() = 0;
     virtual void hTurnOn() = 0;
 };